@@ -0,0 +1,124 @@
+// Cost per task of fanning a batch of small tasks out to
+// common::thread_pool from a thread outside of it: one push() per task,
+// push_bulk(), a wait_group and parallel_for()
+
+#include <turbine.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace turbine;
+
+using pool = common::thread_pool;
+
+namespace {
+
+  constexpr const uint64_t batch = 10000;
+  constexpr const int batches = 40;
+  constexpr const int rounds = 3;
+
+  class counter {
+  public:
+    explicit counter(uint64_t target) noexcept : m_done{0}, m_target{target} {
+    }
+
+    void finish_one() {
+      if (m_done.fetch_add(1, std::memory_order_acq_rel) + 1 == m_target)
+        m_done.notify_all();
+    }
+
+    void wait() {
+      for (auto d = m_done.load(); d != m_target; d = m_done.load())
+        m_done.wait(d);
+    }
+
+  private:
+    std::atomic<uint64_t> m_done;
+    uint64_t m_target;
+  };
+
+  // Stands in for parsing a small record
+  void work(std::atomic<uint64_t> &sum, uint64_t i) {
+    uint64_t h = i;
+    for (int k = 0; k < 16; k++)
+      h = h * 0x9E3779B97F4A7C15ull + 1;
+    sum.fetch_add(h & 1, std::memory_order_relaxed);
+  }
+
+  // Nanoseconds per task, best of a few rounds
+  template <class F>
+  double ns_per_task(F &&run_batch) {
+    double best = 1e18;
+    for (int r = 0; r < rounds; r++) {
+      const auto start = std::chrono::steady_clock::now();
+      for (int b = 0; b < batches; b++)
+        run_batch();
+      const std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count() / (batch * batches));
+    }
+    return best;
+  }
+
+  void compare(uint32_t n_threads) {
+    pool p{n_threads};
+    std::atomic<uint64_t> sum{0};
+
+    const auto single = ns_per_task([&] {
+      counter c{batch};
+      for (uint64_t i = 0; i < batch; i++) {
+        p.push([&, i] {
+          work(sum, i);
+          c.finish_one();
+        });
+      }
+      c.wait();
+    });
+
+    std::vector<pool::task_func> tasks;
+    const auto bulk = ns_per_task([&] {
+      counter c{batch};
+      tasks.clear();
+      for (uint64_t i = 0; i < batch; i++) {
+        tasks.emplace_back([&, i] {
+          work(sum, i);
+          c.finish_one();
+        });
+      }
+      p.push_bulk(tasks);
+      c.wait();
+    });
+
+    const auto group = ns_per_task([&] {
+      pool::wait_group wg{p};
+      for (uint64_t i = 0; i < batch; i++)
+        wg.push([&, i] { work(sum, i); });
+      wg.wait();
+    });
+
+    const auto parallel = ns_per_task([&] {
+      p.parallel_for(uint64_t{0}, batch, uint64_t{64},
+                     [&](uint64_t i) { work(sum, i); });
+    });
+
+    std::printf("%8u %10.1f %10.1f %10.1f %13.1f\n", n_threads, single, bulk,
+                group, parallel);
+  }
+
+} // namespace
+
+int main() {
+  const auto cpus = std::max(std::thread::hardware_concurrency(), 1u);
+  std::printf("%u CPUs, ns/task for batches of %lu tasks (best of %d)\n",
+              cpus, static_cast<unsigned long>(batch), rounds);
+  std::printf("%8s %10s %10s %10s %13s\n", "threads", "push", "push_bulk",
+              "wait_group", "parallel_for");
+  for (uint32_t n = 1; n <= std::max(cpus * 2, 4u); n *= 2)
+    compare(n);
+  return 0;
+}
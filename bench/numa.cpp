@@ -0,0 +1,119 @@
+// Memory-bound sums over buffers spread across the NUMA nodes, with
+// node-pinned workers and node affinity hints against unpinned workers
+// taking tasks in any order. Each buffer is first touched by a task with
+// the hint for its node, so its pages live there when the hint is kept.
+
+#include <turbine.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace turbine;
+
+using pool = common::thread_pool;
+
+namespace {
+
+  constexpr const size_t chunk_words = (size_t{1} << 20) / 8; // 1 MiB
+  constexpr const size_t chunks_per_node = 64;
+  constexpr const int passes = 10;
+
+  struct chunk {
+    uint32_t node;
+    std::unique_ptr<uint64_t[]> words;
+  };
+
+  class counter {
+  public:
+    explicit counter(uint64_t target) noexcept : m_done{0}, m_target{target} {
+    }
+
+    void finish_one() {
+      if (m_done.fetch_add(1, std::memory_order_acq_rel) + 1 == m_target)
+        m_done.notify_all();
+    }
+
+    void wait() {
+      for (auto d = m_done.load(); d != m_target; d = m_done.load())
+        m_done.wait(d);
+    }
+
+  private:
+    std::atomic<uint64_t> m_done;
+    uint64_t m_target;
+  };
+
+  // Pushes a task per chunk and waits for all of them
+  template <class F>
+  void for_each_chunk(pool &p, std::vector<chunk> &chunks, bool hint,
+                      F const &fnc) {
+    counter c{chunks.size()};
+    for (auto &ch : chunks) {
+      const auto aff = hint ? pool::affinity::node(ch.node)
+                            : pool::affinity::any();
+      p.push(
+          [&c, &ch, &fnc] {
+            fnc(ch);
+            c.finish_one();
+          },
+          aff);
+    }
+    c.wait();
+  }
+
+  // GiB/s summed
+  double run(pool::pinning pin, bool hint) {
+    pool::options opts;
+    opts.pin = pin;
+    pool p{opts};
+    std::vector<chunk> chunks;
+    for (auto id : p.nodes()) {
+      for (size_t i = 0; i < chunks_per_node; i++)
+        chunks.push_back({id, std::make_unique_for_overwrite<uint64_t[]>(
+                                  chunk_words)});
+    }
+    for_each_chunk(p, chunks, hint, [](chunk &ch) {
+      for (size_t i = 0; i < chunk_words; i++)
+        ch.words[i] = i;
+    });
+
+    std::atomic<uint64_t> total{0};
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < passes; i++) {
+      for_each_chunk(p, chunks, hint, [&total](chunk &ch) {
+        uint64_t sum = 0;
+        for (size_t j = 0; j < chunk_words; j++)
+          sum += ch.words[j];
+        total.fetch_add(sum, std::memory_order_relaxed);
+      });
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    const uint64_t per_chunk = chunk_words * (chunk_words - 1) / 2;
+    if (total != per_chunk * chunks.size() * passes)
+      std::printf("wrong sum\n");
+    const auto bytes = static_cast<double>(chunks.size() * chunk_words * 8 *
+                                           static_cast<size_t>(passes));
+    return bytes / elapsed.count() / (1024.0 * 1024 * 1024);
+  }
+
+} // namespace
+
+int main() {
+  pool probe{1};
+  std::printf("%zu NUMA nodes, %zu MiB per node, %d passes\n",
+              probe.nodes().size(), chunks_per_node, passes);
+  std::printf("  unpinned, no hints     %6.2f GiB/s\n",
+              run(pool::pinning::none, false));
+  std::printf("  node-pinned, no hints  %6.2f GiB/s\n",
+              run(pool::pinning::node, false));
+  std::printf("  node-pinned, hints     %6.2f GiB/s\n",
+              run(pool::pinning::node, true));
+  return 0;
+}
@@ -0,0 +1,98 @@
+// Cost of an iteration of io::static_loop against io::loop. A set of
+// pipes is kept readable, so every iteration dispatches all of them.
+
+#include <turbine.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+
+using namespace turbine;
+
+using result = io::source::result;
+using poll_events = io::poll_source::poll_events;
+
+namespace {
+
+  constexpr const uint64_t events = 1600000;
+  constexpr const int rounds = 5;
+
+  template <size_t N>
+  using pipes = std::array<posix::pipe::pair, N>;
+
+  template <size_t N>
+  void make_readable(pipes<N> &p) {
+    for (auto &pp : p) {
+      pp = posix::pipe::make(posix::pipe::flags::non_blocking);
+      pp.write_end->write('x');
+    }
+  }
+
+  template <size_t N, class F>
+  double ns_per_iteration(F &&run) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    return static_cast<double>(ns) / (events / N);
+  }
+
+  template <size_t N>
+  double dynamic_loop(pipes<N> &p) {
+    io::loop lp;
+    uint64_t calls = 0;
+    for (auto &pp : p) {
+      lp.add_poll(pp.read_end, poll_events::in, [&](poll_events) {
+        if (++calls == events)
+          lp.quit(0);
+        return result::keep_going;
+      });
+    }
+    return ns_per_iteration<N>([&lp] { lp.run(); });
+  }
+
+  template <size_t N, class F, size_t... I>
+  auto make_static_loop(pipes<N> &p, F &cb, std::index_sequence<I...>) {
+    return io::static_loop{
+        io::static_poll{p[I].read_end, poll_events::in, cb}...};
+  }
+
+  template <size_t N>
+  double static_loop(pipes<N> &p) {
+    uint64_t calls = 0;
+    auto cb = [&calls](auto &lp, poll_events) {
+      if (++calls == events)
+        lp.quit(0);
+      return result::keep_going;
+    };
+    auto lp = make_static_loop(p, cb, std::make_index_sequence<N>{});
+    return ns_per_iteration<N>([&lp] { lp.run(); });
+  }
+
+  template <size_t N>
+  void compare() {
+    pipes<N> p;
+    make_readable(p);
+    double best_dynamic = 1e18;
+    double best_static = 1e18;
+    for (int i = 0; i < rounds; i++) {
+      best_dynamic = std::min(best_dynamic, dynamic_loop(p));
+      best_static = std::min(best_static, static_loop(p));
+    }
+    std::printf("%zu readable pipes, best of %d runs\n", N, rounds);
+    std::printf("  io::loop         %8.1f ns/iteration\n", best_dynamic);
+    std::printf("  io::static_loop  %8.1f ns/iteration (%.2fx)\n",
+                best_static, best_dynamic / best_static);
+  }
+
+} // namespace
+
+int main() {
+  compare<8>();
+  compare<64>();
+  return 0;
+}
@@ -0,0 +1,146 @@
+// Tasks per second through common::thread_pool by number of threads,
+// against a pool with a single mutex-protected queue like the one it
+// replaced
+
+#include <turbine.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace turbine;
+
+namespace {
+
+  constexpr const uint64_t external_tasks = 400000;
+  constexpr const uint32_t fork_depth = 17; // 2^18 - 1 tasks
+  constexpr const int rounds = 3;
+
+  // One deque behind one mutex, woken with notify_one() per push
+  class mutex_pool {
+  public:
+    explicit mutex_pool(uint32_t n_threads) {
+      for (uint32_t i = 0; i < n_threads; i++)
+        m_threads.emplace_back([this] { run(); });
+    }
+
+    ~mutex_pool() {
+      {
+        std::lock_guard lk{m_lock};
+        m_stop = true;
+      }
+      m_cond.notify_all();
+      m_threads.clear();
+    }
+
+    void push(common::thread_pool::task_func fnc) {
+      {
+        std::lock_guard lk{m_lock};
+        m_tasks.push_back(std::move(fnc));
+      }
+      m_cond.notify_one();
+    }
+
+  private:
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<common::thread_pool::task_func> m_tasks;
+    bool m_stop = false;
+    std::vector<std::jthread> m_threads;
+
+    void run() {
+      for (;;) {
+        std::unique_lock lk{m_lock};
+        m_cond.wait(lk, [this] { return m_stop || !m_tasks.empty(); });
+        if (m_tasks.empty())
+          return;
+        auto task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        lk.unlock();
+        task();
+      }
+    }
+  };
+
+  struct counter {
+    std::atomic<uint64_t> done{0};
+    uint64_t target;
+
+    void finish_one() {
+      if (done.fetch_add(1, std::memory_order_acq_rel) + 1 == target)
+        done.notify_all();
+    }
+
+    void wait() {
+      for (auto d = done.load(); d != target; d = done.load())
+        done.wait(d);
+    }
+  };
+
+  template <class F>
+  double tasks_per_second(uint64_t n, F &&run) {
+    double best = 0;
+    for (int i = 0; i < rounds; i++) {
+      const auto start = std::chrono::steady_clock::now();
+      run();
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      best = std::max(best, static_cast<double>(n) / elapsed.count());
+    }
+    return best;
+  }
+
+  // Tasks pushed one by one from a thread outside the pool
+  template <class Pool>
+  double external(uint32_t n_threads) {
+    Pool pool{n_threads};
+    return tasks_per_second(external_tasks, [&pool] {
+      counter c{0, external_tasks};
+      for (uint64_t i = 0; i < external_tasks; i++)
+        pool.push([&c] { c.finish_one(); });
+      c.wait();
+    });
+  }
+
+  // Each task pushes two more from inside the pool, down to a depth
+  template <class Pool>
+  void fork(Pool &pool, counter &c, uint32_t depth) {
+    if (depth > 0) {
+      pool.push([&pool, &c, depth] { fork(pool, c, depth - 1); });
+      pool.push([&pool, &c, depth] { fork(pool, c, depth - 1); });
+    }
+    c.finish_one();
+  }
+
+  template <class Pool>
+  double nested(uint32_t n_threads) {
+    const uint64_t n = (uint64_t{1} << (fork_depth + 1)) - 1;
+    Pool pool{n_threads};
+    return tasks_per_second(n, [&pool, n] {
+      counter c{0, n};
+      pool.push([&pool, &c] { fork(pool, c, fork_depth); });
+      c.wait();
+    });
+  }
+
+} // namespace
+
+int main() {
+  const auto cpus = std::max(std::thread::hardware_concurrency(), 1u);
+  std::printf("%u CPUs, tasks/s (best of %d)\n", cpus, rounds);
+  std::printf("%8s %14s %14s %14s %14s\n", "threads", "external",
+              "mutex ext.", "nested", "mutex nested");
+  for (uint32_t n = 1; n <= std::max(cpus * 2, 4u); n *= 2) {
+    std::printf("%8u %14.0f %14.0f %14.0f %14.0f\n", n,
+                external<common::thread_pool>(n), external<mutex_pool>(n),
+                nested<common::thread_pool>(n), nested<mutex_pool>(n));
+  }
+  return 0;
+}
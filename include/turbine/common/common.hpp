@@ -1,7 +1,11 @@
 #pragma once
 
+#include <turbine/common/deadline_queue.hpp>
 #include <turbine/common/error.hpp>
 #include <turbine/common/flags.hpp>
+#include <turbine/common/inplace_function.hpp>
 #include <turbine/common/macros.hpp>
+#include <turbine/common/mpsc_queue.hpp>
 #include <turbine/common/thread_pool.hpp>
 #include <turbine/common/utility.hpp>
+#include <turbine/common/work_deque.hpp>
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <turbine/common/macros.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace turbine::common {
+
+  // Thread-safe queue of pointers in priority classes, class 0 being the
+  // most urgent. Within a class, items with a deadline are taken earliest
+  // deadline first and ahead of items without one, which are taken in
+  // push order. An item which has been waiting for `aging` counts as one
+  // class more urgent, and one more for every further `aging`, and goes
+  // first among those of its effective class which have waited less, so
+  // no class starves however busy the ones above it are. Times are given
+  // by the caller, in nanoseconds of a monotonic clock.
+  template <class T, size_t Classes>
+  class deadline_queue {
+    struct node {
+      T *item;
+      uint64_t deadline;
+      uint64_t enqueued;
+      uint64_t seq;
+      uint32_t refs; // of the containers still holding it
+      bool taken;
+    };
+
+    // Every node is in the FIFO, those with a deadline in the heap too.
+    // Taking one from either leaves it marked in the other, it's dropped
+    // from there once it reaches the front.
+    struct class_queue {
+      std::vector<node *> heap;
+      std::deque<node *> fifo;
+    };
+
+  public:
+    static constexpr const size_t num_classes = Classes;
+    static constexpr const uint64_t no_deadline = UINT64_MAX;
+
+    // How long taken items were queued
+    struct delay_stats {
+      uint64_t items = 0;
+      uint64_t total_ns = 0;
+      uint64_t max_ns = 0;
+      uint64_t deadline_misses = 0; // taken after their deadline
+      // by the bit width of the delay in nanoseconds
+      std::array<uint64_t, 65> histogram{};
+
+      // Delay which the given fraction of items didn't exceed, rounded up
+      // to a power of 2
+      std::chrono::nanoseconds percentile(double fraction) const noexcept {
+        const auto wanted = static_cast<uint64_t>(
+            std::clamp(fraction, 0.0, 1.0) * static_cast<double>(items));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < histogram.size(); i++) {
+          seen += histogram[i];
+          if (seen >= wanted && seen > 0) {
+            const auto bound = i < 64 ? (uint64_t{1} << i) - 1 : UINT64_MAX;
+            return std::chrono::nanoseconds{
+                static_cast<int64_t>(std::min<uint64_t>(bound, max_ns))};
+          }
+        }
+        return std::chrono::nanoseconds{0};
+      }
+    };
+
+    explicit deadline_queue(std::chrono::nanoseconds aging) noexcept
+        : m_aging{static_cast<uint64_t>(std::max<int64_t>(aging.count(), 0))}
+        , m_lock{}
+        , m_classes{}
+        , m_seq{0}
+        , m_count{0}
+        , m_counts{}
+        , m_next_aging{}
+        , m_stats{} {
+      for (auto &next : m_next_aging)
+        next.store(no_deadline, std::memory_order_relaxed);
+    }
+
+    ~deadline_queue() {
+      for (auto &q : m_classes) {
+        for (auto *n : q.heap)
+          release(n);
+        for (auto *n : q.fifo)
+          release(n);
+      }
+    }
+
+    void push(T *item, size_t cls, uint64_t deadline, uint64_t now) {
+      M_ASSERT(cls < Classes);
+      cls = std::min(cls, Classes - 1);
+      std::lock_guard lk{m_lock};
+      auto &q = m_classes[cls];
+      auto *n = new node{item, deadline, now, m_seq++, 1, false};
+      q.fifo.push_back(n);
+      if (deadline != no_deadline) {
+        n->refs++;
+        q.heap.push_back(n);
+        std::ranges::push_heap(q.heap, later);
+      }
+      m_count.fetch_add(1, std::memory_order_relaxed);
+      m_counts[cls].fetch_add(1, std::memory_order_relaxed);
+      update_next_aging();
+    }
+
+    // Takes the most urgent item, but only one which is (or has aged into)
+    // class `max_class` or a more urgent one
+    T *take(uint64_t now, size_t max_class = Classes - 1) {
+      if (empty())
+        return nullptr;
+      std::lock_guard lk{m_lock};
+      size_t best = Classes;
+      uint64_t best_class = 0;
+      uint64_t best_enqueued = 0;
+      for (size_t c = 0; c < Classes; c++) {
+        auto &q = m_classes[c];
+        drop_taken(q);
+        if (q.fifo.empty())
+          continue;
+        auto const &front = *q.fifo.front();
+        const auto eff = effective_class(c, front, now);
+        if (best == Classes || eff < best_class ||
+            (eff == best_class && front.enqueued < best_enqueued)) {
+          best = c;
+          best_class = eff;
+          best_enqueued = front.enqueued;
+        }
+      }
+      if (best == Classes || best_class > max_class)
+        return nullptr;
+      auto &q = m_classes[best];
+      node *n = nullptr;
+      if (!q.heap.empty() && !has_aged(*q.fifo.front(), now)) {
+        std::ranges::pop_heap(q.heap, later);
+        n = q.heap.back();
+        q.heap.pop_back();
+      } else {
+        n = q.fifo.front();
+        q.fifo.pop_front();
+      }
+      n->taken = true;
+      auto *item = n->item;
+      record(m_stats[best], *n, now);
+      release(n);
+      m_count.fetch_sub(1, std::memory_order_relaxed);
+      m_counts[best].fetch_sub(1, std::memory_order_relaxed);
+      update_next_aging();
+      return item;
+    }
+
+    // Removes the oldest item of the least urgent class, for shedding
+    // load. Its delay isn't recorded.
+    T *shed() {
+      if (empty())
+        return nullptr;
+      std::lock_guard lk{m_lock};
+      for (size_t c = Classes; c-- > 0;) {
+        auto &q = m_classes[c];
+        drop_taken(q);
+        if (q.fifo.empty())
+          continue;
+        auto *n = q.fifo.front();
+        q.fifo.pop_front();
+        n->taken = true;
+        auto *item = n->item;
+        release(n);
+        m_count.fetch_sub(1, std::memory_order_relaxed);
+        m_counts[c].fetch_sub(1, std::memory_order_relaxed);
+        update_next_aging();
+        return item;
+      }
+      return nullptr;
+    }
+
+    bool empty() const noexcept {
+      return m_count.load(std::memory_order_seq_cst) == 0;
+    }
+
+    // Whether take() would return an item with `max_class`, without
+    // locking
+    bool has(size_t max_class, uint64_t now) const noexcept {
+      max_class = std::min(max_class, Classes - 1);
+      for (size_t c = 0; c <= max_class; c++) {
+        if (m_counts[c].load(std::memory_order_relaxed) > 0)
+          return true;
+      }
+      return m_next_aging[max_class].load(std::memory_order_relaxed) <= now;
+    }
+
+    std::array<delay_stats, Classes> stats() const {
+      std::lock_guard lk{m_lock};
+      return m_stats;
+    }
+
+  private:
+    uint64_t m_aging; // 0 for never
+    mutable std::mutex m_lock;
+    std::array<class_queue, Classes> m_classes;
+    uint64_t m_seq;
+    std::atomic<size_t> m_count;
+    std::array<std::atomic<size_t>, Classes> m_counts; // by class
+    // by class, when an item of a less urgent one ages into it
+    std::array<std::atomic<uint64_t>, Classes> m_next_aging;
+    std::array<delay_stats, Classes> m_stats;
+
+    deadline_queue(deadline_queue const &) = delete;
+    deadline_queue &operator=(deadline_queue const &) = delete;
+
+    static bool later(node const *a, node const *b) noexcept {
+      if (a->deadline != b->deadline)
+        return a->deadline > b->deadline;
+      return a->seq > b->seq;
+    }
+
+    static void release(node *n) noexcept {
+      if (--n->refs == 0)
+        delete n;
+    }
+
+    static void drop_taken(class_queue &q) noexcept {
+      while (!q.fifo.empty() && q.fifo.front()->taken) {
+        release(q.fifo.front());
+        q.fifo.pop_front();
+      }
+      while (!q.heap.empty() && q.heap.front()->taken) {
+        std::ranges::pop_heap(q.heap, later);
+        release(q.heap.back());
+        q.heap.pop_back();
+      }
+    }
+
+    uint64_t waited(node const &n, uint64_t now) const noexcept {
+      return now > n.enqueued ? now - n.enqueued : 0;
+    }
+
+    bool has_aged(node const &n, uint64_t now) const noexcept {
+      return m_aging > 0 && waited(n, now) >= m_aging;
+    }
+
+    uint64_t effective_class(size_t cls, node const &n,
+                             uint64_t now) const noexcept {
+      if (m_aging == 0)
+        return cls;
+      return cls - std::min<uint64_t>(cls, waited(n, now) / m_aging);
+    }
+
+    // Called with the oldest items of each class at the FIFO fronts
+    void update_next_aging() noexcept {
+      std::array<uint64_t, Classes> next;
+      next.fill(no_deadline);
+      if (m_aging > 0) {
+        for (size_t c = 1; c < Classes; c++) {
+          auto &q = m_classes[c];
+          drop_taken(q);
+          if (q.fifo.empty())
+            continue;
+          for (size_t k = 0; k < c; k++) {
+            next[k] = std::min(next[k],
+                               q.fifo.front()->enqueued + (c - k) * m_aging);
+          }
+        }
+      }
+      for (size_t k = 0; k < Classes; k++)
+        m_next_aging[k].store(next[k], std::memory_order_relaxed);
+    }
+
+    static void record(delay_stats &s, node const &n, uint64_t now) noexcept {
+      const auto delay = now > n.enqueued ? now - n.enqueued : 0;
+      s.items++;
+      s.total_ns += delay;
+      s.max_ns = std::max(s.max_ns, delay);
+      s.histogram[std::bit_width(delay)]++;
+      if (now > n.deadline)
+        s.deadline_misses++;
+    }
+  };
+
+} // namespace turbine::common
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <turbine/common/macros.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace turbine::common {
+
+  inline constexpr const size_t default_inplace_capacity = 64;
+
+  template <class Signature, size_t Capacity = default_inplace_capacity>
+  class inplace_function;
+
+  // Move-only replacement for std::function. Callables of up to Capacity
+  // bytes are stored inline, so wrapping a lambda doesn't allocate and
+  // calling it is a single indirect call. Bigger callables, or ones which
+  // may throw when moved, are kept on the heap instead.
+  template <class R, class... Args, size_t Capacity>
+  class inplace_function<R(Args...), Capacity> {
+    enum class op {
+      relocate, // move into the destination and destroy the source
+      destroy,
+    };
+
+    using invoke_func = R (*)(void *, Args &&...);
+    using manage_func = void (*)(op, void *, void *) noexcept;
+
+    template <class T>
+    static constexpr bool is_inline =
+        sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible_v<T>;
+
+  public:
+    static constexpr const size_t capacity = Capacity;
+
+    inplace_function() noexcept : m_invoke{nullptr}, m_manage{nullptr} {
+    }
+
+    inplace_function(std::nullptr_t) noexcept : inplace_function{} {
+    }
+
+    template <class F>
+      requires(!std::is_same_v<std::remove_cvref_t<F>, inplace_function> &&
+               std::is_invocable_r_v<R, std::decay_t<F> &, Args...>)
+    inplace_function(F &&fnc) : inplace_function{} {
+      using T = std::decay_t<F>;
+      if constexpr (is_inline<T>)
+        ::new (static_cast<void *>(m_storage)) T(std::forward<F>(fnc));
+      else
+        ::new (static_cast<void *>(m_storage)) T *{new T(std::forward<F>(fnc))};
+      m_invoke = &invoke<T>;
+      m_manage = &manage<T>;
+    }
+
+    inplace_function(inplace_function &&other) noexcept
+        : inplace_function{} {
+      take(other);
+    }
+
+    inplace_function &operator=(inplace_function &&other) noexcept {
+      if (this != &other) {
+        reset();
+        take(other);
+      }
+      return *this;
+    }
+
+    ~inplace_function() {
+      reset();
+    }
+
+    explicit operator bool() const noexcept {
+      return m_invoke != nullptr;
+    }
+
+    R operator()(Args... args) {
+      assert(m_invoke);
+      return m_invoke(m_storage, std::forward<Args>(args)...);
+    }
+
+  private:
+    alignas(std::max_align_t) std::byte m_storage[Capacity];
+    invoke_func m_invoke;
+    manage_func m_manage;
+
+    inplace_function(inplace_function const &) = delete;
+    inplace_function &operator=(inplace_function const &) = delete;
+
+    template <class T>
+    static T *target(void *storage) noexcept {
+      if constexpr (is_inline<T>)
+        return std::launder(static_cast<T *>(storage));
+      else
+        return *static_cast<T **>(storage);
+    }
+
+    template <class T>
+    static R invoke(void *storage, Args &&...args) {
+      if constexpr (std::is_void_v<R>)
+        std::invoke(*target<T>(storage), std::forward<Args>(args)...);
+      else
+        return std::invoke(*target<T>(storage), std::forward<Args>(args)...);
+    }
+
+    template <class T>
+    static void manage(op o, void *dst, void *src) noexcept {
+      if constexpr (is_inline<T>) {
+        auto *fnc = target<T>(src);
+        if (o == op::relocate)
+          ::new (dst) T(std::move(*fnc));
+        fnc->~T();
+      } else if (o == op::relocate) {
+        ::new (dst) T *{target<T>(src)};
+      } else {
+        delete target<T>(src);
+      }
+    }
+
+    void take(inplace_function &other) noexcept {
+      if (!other.m_manage)
+        return;
+      other.m_manage(op::relocate, m_storage, other.m_storage);
+      m_invoke = std::exchange(other.m_invoke, nullptr);
+      m_manage = std::exchange(other.m_manage, nullptr);
+    }
+
+    void reset() noexcept {
+      if (!m_manage)
+        return;
+      m_manage(op::destroy, nullptr, m_storage);
+      m_invoke = nullptr;
+      m_manage = nullptr;
+    }
+  };
+
+} // namespace turbine::common
@@ -35,5 +35,5 @@
     }                                                                         \
   } while (0)
 #else
-#define M_ASSSERT(expr)
+#define M_ASSERT(expr)
 #endif
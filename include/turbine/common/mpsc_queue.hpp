@@ -0,0 +1,110 @@
+#pragma once
+
+#include <turbine/common/macros.hpp>
+
+#include <atomic>
+#include <utility>
+
+namespace turbine::common {
+
+  // Lock-free multiple producer, single consumer queue. Producers push onto
+  // an atomic stack and the consumer takes everything at once, restoring
+  // push order, so a batch costs the consumer a single atomic exchange.
+  template <class T>
+  class mpsc_queue {
+    struct node {
+      T value;
+      node *next;
+    };
+
+  public:
+    // Items taken from the queue, in the order they were pushed
+    class batch {
+      friend class mpsc_queue;
+
+    public:
+      batch() noexcept : m_head{nullptr} {
+      }
+
+      batch(batch &&other) noexcept : m_head{other.m_head} {
+        other.m_head = nullptr;
+      }
+
+      batch &operator=(batch &&other) noexcept {
+        std::swap(m_head, other.m_head);
+        return *this;
+      }
+
+      ~batch() {
+        while (m_head)
+          pop();
+      }
+
+      bool empty() const noexcept {
+        return m_head == nullptr;
+      }
+
+      T pop() {
+        auto *n = m_head;
+        m_head = n->next;
+        T value{std::move(n->value)};
+        delete n;
+        return value;
+      }
+
+    private:
+      node *m_head;
+
+      explicit batch(node *head) noexcept : m_head{head} {
+      }
+
+      batch(batch const &) = delete;
+      batch &operator=(batch const &) = delete;
+    };
+
+    mpsc_queue() noexcept : m_head{nullptr} {
+    }
+
+    ~mpsc_queue() {
+      take_all();
+    }
+
+    // Can be called from any thread. Returns true if the queue was empty,
+    // so only the first push after the consumer took a batch needs to wake
+    // it up.
+    bool push(T value) {
+      auto *n = new node{std::move(value), nullptr};
+      auto *head = m_head.load(std::memory_order_relaxed);
+      do {
+        n->next = head;
+      } while (!m_head.compare_exchange_weak(head, n,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+      return head == nullptr;
+    }
+
+    // Consumer only
+    batch take_all() noexcept {
+      auto *n = m_head.exchange(nullptr, std::memory_order_acquire);
+      node *head = nullptr;
+      while (n) {
+        auto *next = n->next;
+        n->next = head;
+        head = n;
+        n = next;
+      }
+      return batch{head};
+    }
+
+    bool empty() const noexcept {
+      return m_head.load(std::memory_order_relaxed) == nullptr;
+    }
+
+  private:
+    std::atomic<node *> m_head;
+
+    mpsc_queue(mpsc_queue const &) = delete;
+    mpsc_queue &operator=(mpsc_queue const &) = delete;
+  };
+
+} // namespace turbine::common
@@ -1,82 +1,1133 @@
 #pragma once
 
+#include <turbine/common/deadline_queue.hpp>
+#include <turbine/common/error.hpp>
+#include <turbine/common/inplace_function.hpp>
 #include <turbine/common/macros.hpp>
+#include <turbine/common/utility.hpp>
+#include <turbine/common/work_deque.hpp>
+#include <turbine/linux/cgroup.hpp>
+#include <turbine/linux/numa.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <concepts>
+#include <cmath>
 #include <condition_variable>
 #include <cstdint>
 #include <deque>
-#include <functional>
+#include <exception>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <ranges>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace turbine::common {
 
+  // Work-stealing thread pool. Each worker has its own lock-free deque,
+  // tasks pushed from a worker go onto it and are run newest first, tasks
+  // pushed from other threads go through a shared injection queue. A
+  // worker which runs out of tasks takes a batch from the injection queue
+  // or steals the oldest task of another worker, spins for a little while
+  // and then parks until new tasks are pushed. Tasks still queued when the
+  // pool is destroyed are run first.
+  //
+  // Workers are grouped by the NUMA node of the CPU they're assigned and
+  // can be pinned to it. They steal from workers of their own node before
+  // looking at other nodes, and tasks can be pushed with a node or core
+  // affinity hint.
+  //
+  // By default there is a worker per CPU the pool may use, limited by the
+  // cgroup's CPU quota. The number of workers can be changed while tasks
+  // are running, up to the number of workers the pool was made for.
+  //
+  // Plain tasks are normal priority ones. Tasks pushed with another
+  // priority, or with a deadline, go through a shared queue instead, see
+  // common::deadline_queue. High priority tasks are run before any other,
+  // normal ones with a deadline before plain ones and low priority ones
+  // once there are no plain tasks left.
+  //
+  // The number of queued tasks can be bounded, see options::max_queued.
   class thread_pool {
+  public:
+    using task_func = inplace_function<void(void)>;
+
+    // Priority classes of push()
+    enum class priority : uint8_t {
+      high,
+      normal, // the same as plain tasks
+      low,
+    };
+
+    static constexpr const size_t num_priorities = 3;
+
+    // What push() does when options::max_queued tasks are queued already
+    enum class overflow {
+      block,       // wait for a task to be taken, a worker runs tasks
+      reject,      // return false
+      caller_runs, // run the task on the calling thread
+      drop_oldest, // destroy the oldest queued task without running it
+    };
+
+    // Called with true when the number of queued tasks reaches the high
+    // watermark and with false when it's back down to the low one, from
+    // whichever thread pushed or took the task. Mustn't push to the pool.
+    using func_watermark = inplace_function<void(bool)>;
+
+    using delay_stats =
+        deadline_queue<task_func, num_priorities>::delay_stats;
+
+    // How workers are tied to their CPUs
+    enum class pinning {
+      none, // wherever the scheduler puts them
+      node, // each to all the used CPUs of its NUMA node
+      core, // each to its own CPU
+    };
+
+    struct options {
+      // 0 for default_size(), CPUs are handed out node by node and reused
+      // when there are more threads
+      uint32_t threads = 0;
+      // most threads resize() can grow the pool to, 0 for one per CPU (or
+      // `threads` if that's more)
+      uint32_t max_threads = 0;
+      pinning pin = pinning::none;
+      // CPUs to use, empty for all the CPUs this process may run on
+      std::vector<uint32_t> cpus{};
+      // how often default_size() is checked again and the pool resized to
+      // it, 0 to never. Only while `threads` is 0.
+      std::chrono::milliseconds resize_interval{0};
+      // time after which a task pushed with a priority is treated as one
+      // class higher (and after which a low priority one runs before any
+      // plain task), 0 to never
+      std::chrono::milliseconds aging{100};
+      // tasks which may be queued (not yet running) at once, 0 for no
+      // limit, and what to do about more
+      size_t max_queued = 0;
+      enum overflow on_overflow = overflow::block;
+      // for watermark_func(), 0 for no callbacks
+      size_t high_watermark = 0;
+      size_t low_watermark = 0;
+    };
+
+    // Where a task would rather run. It's only a preference, a task whose
+    // node or core is busy can still be stolen by other workers.
+    class affinity {
+      friend class thread_pool;
+
+    public:
+      static affinity any() noexcept {
+        return {kind::any, 0};
+      }
+
+      // NUMA node by its id in /sys/devices/system/node
+      static affinity node(uint32_t id) noexcept {
+        return {kind::node, id};
+      }
+
+      // The worker assigned the CPU
+      static affinity core(uint32_t cpu) noexcept {
+        return {kind::core, cpu};
+      }
+
+    private:
+      enum class kind { any, node, core };
+
+      kind m_kind;
+      uint32_t m_id;
+
+      affinity(kind k, uint32_t id) noexcept : m_kind{k}, m_id{id} {
+      }
+    };
+
+  private:
+    static constexpr const uint32_t spin_rounds = 64;
+    static constexpr const size_t injected_batch = 32;
+
+    // Tasks pushed from outside of the workers which should run on them
+    struct inbox {
+      std::mutex lock;
+      std::deque<task_func *> tasks;
+      std::atomic<size_t> count{0};
+
+      void push(task_func *task) {
+        std::lock_guard lk{lock};
+        tasks.push_back(task);
+        count.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      bool empty() const noexcept {
+        return count.load(std::memory_order_seq_cst) == 0;
+      }
+
+      template <class Tasks>
+      void push_bulk(Tasks &tasks) {
+        std::lock_guard lk{lock};
+        for (auto &task : tasks)
+          this->tasks.push_back(task.release());
+        count.fetch_add(tasks.size(), std::memory_order_relaxed);
+      }
+
+      // Takes the oldest task and moves up to `batch - 1` more onto `dst`
+      task_func *take(work_deque<task_func> *dst = nullptr,
+                      size_t batch = 1) {
+        if (count.load(std::memory_order_relaxed) == 0)
+          return nullptr;
+        std::lock_guard lk{lock};
+        if (tasks.empty())
+          return nullptr;
+        auto *task = tasks.front();
+        tasks.pop_front();
+        size_t taken = 1;
+        for (; dst && taken < batch && !tasks.empty(); taken++) {
+          dst->push(tasks.front());
+          tasks.pop_front();
+        }
+        count.fetch_sub(taken, std::memory_order_relaxed);
+        return task;
+      }
+    };
+
+    struct worker {
+      work_deque<task_func> tasks;
+      inbox mailbox; // core affinity
+      std::jthread thread;
+      uint64_t rng; // for picking victims
+      uint32_t node; // index into m_nodes
+      uint32_t cpu;
+      std::atomic<uint32_t> epoch{0}; // bumped to wake it up
+      std::atomic<bool> parked{false};
+      std::atomic<bool> active{false}; // cleared to retire it
+    };
+
+    struct node_state {
+      uint32_t id;
+      std::vector<uint32_t> cpus; // used by the pool
+      std::vector<worker *> workers;
+      inbox tasks; // node affinity
+    };
 
   public:
-    using task_func = std::function<void(void)>;
+    thread_pool(uint32_t n_threads = 0) : thread_pool{options{n_threads}} {
+    }
 
-    thread_pool(uint32_t n_threads = 0)
-        : m_lock{}
-        , m_threads{}
-        , m_tasks{}
-        , m_cond{}
-        , m_stop{false} {
-      if (n_threads == 0)
-        n_threads = std::thread::hardware_concurrency();
-      m_threads.reserve(n_threads);
-      for (uint32_t i = 0; i < n_threads; ++i)
-        m_threads.emplace_back(std::bind(&thread_pool::thread_func, this));
+    explicit thread_pool(options const &opts)
+        : m_pin{opts.pin}
+        , m_workers{}
+        , m_nodes{}
+        , m_cpu_workers{}
+        , m_injected{}
+        , m_scheduled{opts.aging}
+        , m_counted{opts.max_queued > 0 || opts.high_watermark > 0}
+        , m_max_queued{opts.max_queued}
+        , m_overflow{opts.on_overflow}
+        , m_high_watermark{opts.high_watermark}
+        , m_low_watermark{std::min(opts.low_watermark, opts.high_watermark)}
+        , m_queued{0}
+        , m_blocked{0}
+        , m_rejected{0}
+        , m_dropped{0}
+        , m_above_watermark{false}
+        , m_watermark_lock{}
+        , m_watermark{}
+        , m_sleepers{0}
+        , m_size{0}
+        , m_stop{false}
+        , m_resize_lock{}
+        , m_monitor{} {
+      make_nodes(opts.cpus);
+      std::vector<std::pair<uint32_t, uint32_t>> cpus; // node, cpu
+      for (uint32_t i = 0; i < m_nodes.size(); i++) {
+        for (auto cpu : m_nodes[i]->cpus)
+          cpus.emplace_back(i, cpu);
+      }
+      const auto n_threads = opts.threads ? opts.threads : default_size();
+      const auto n_slots = std::max(
+          n_threads, opts.max_threads ? opts.max_threads
+                                      : static_cast<uint32_t>(cpus.size()));
+      // every worker exists from the start, resizing only starts and
+      // retires their threads, so thieves never see the list change
+      m_workers.reserve(n_slots);
+      for (uint32_t i = 0; i < n_slots; ++i) {
+        auto w = std::make_unique<worker>();
+        w->rng = 0x9E3779B97F4A7C15ull * (i + 1);
+        std::tie(w->node, w->cpu) = cpus[i % cpus.size()];
+        m_nodes[w->node]->workers.push_back(w.get());
+        if (w->cpu >= m_cpu_workers.size())
+          m_cpu_workers.resize(w->cpu + 1);
+        if (!m_cpu_workers[w->cpu])
+          m_cpu_workers[w->cpu] = w.get();
+        m_workers.push_back(std::move(w));
+      }
+      try {
+        resize(n_threads);
+        if (opts.threads == 0 && opts.resize_interval.count() > 0) {
+          m_monitor = std::jthread{[this, interval = opts.resize_interval](
+                                       std::stop_token st) {
+            monitor(st, interval);
+          }};
+        }
+      } catch (...) {
+        stop();
+        throw;
+      }
     }
 
     ~thread_pool() {
-      {
-        std::unique_lock lk{m_lock};
-        m_stop = true;
+      stop();
+    }
+
+    // Number of running workers
+    uint32_t size() const noexcept {
+      return m_size.load(std::memory_order_relaxed);
+    }
+
+    uint32_t max_size() const noexcept {
+      return static_cast<uint32_t>(m_workers.size());
+    }
+
+    // Starts or retires workers, clamped to 1 to max_size(). A retired
+    // worker finishes its current task and hands the rest of its queue
+    // over to the others, no task is dropped. Growing back may wait for a
+    // worker still retiring to finish its task.
+    void resize(uint32_t n_threads) {
+      std::lock_guard lk{m_resize_lock};
+      n_threads = std::clamp<uint32_t>(n_threads, 1, max_size());
+      const auto cur = size();
+      for (auto i = n_threads; i < cur; i++) {
+        auto &w = *m_workers[i];
+        w.active.store(false);
+        w.epoch.fetch_add(1, std::memory_order_seq_cst);
+        w.epoch.notify_one();
       }
-      m_cond.notify_all();
-      for (auto &thrd : m_threads)
-        thrd.join();
+      for (auto i = cur; i < n_threads; i++)
+        start(*m_workers[i]);
+      m_size.store(n_threads, std::memory_order_relaxed);
     }
 
-    void push(task_func fnc) {
-      M_ASSERT(fnc);
-      if (M_LIKELY(fnc)) {
-        {
-          std::lock_guard lk{m_lock};
-          m_tasks.push_back(std::move(fnc));
+    // Workers for the CPUs the pool may use right now: those of its CPUs
+    // still in the affinity mask, at most the cgroup's CPU quota rounded
+    // up, at least 1
+    uint32_t default_size() const {
+      const auto allowed = linux::numa::allowed_cpus();
+      uint32_t n = 0;
+      for (auto const &node : m_nodes) {
+        for (auto cpu : node->cpus)
+          n += std::ranges::binary_search(allowed, cpu) ? 1 : 0;
+      }
+      if (auto limit = linux::cgroup::cpu_limit())
+        n = std::min(n, static_cast<uint32_t>(std::ceil(*limit)));
+      return std::max<uint32_t>(n, 1);
+    }
+
+    // Ids of the NUMA nodes the workers are spread over
+    std::vector<uint32_t> nodes() const {
+      std::vector<uint32_t> ids;
+      for (auto const &n : m_nodes)
+        ids.push_back(n->id);
+      return ids;
+    }
+
+    // Returns false if the task was rejected, see options::on_overflow
+    bool push(task_func fnc) {
+      return push(std::move(fnc), affinity::any());
+    }
+
+    bool push(task_func fnc, affinity aff) {
+      return submit(fnc, aff, false);
+    }
+
+    // Like push() but returns false instead of waiting or running the
+    // task when the queue is full, leaving `fnc` as it was
+    bool try_push(task_func &&fnc) {
+      return submit(fnc, affinity::any(), true);
+    }
+
+    bool try_push(task_func &&fnc, affinity aff) {
+      return submit(fnc, aff, true);
+    }
+
+    bool push(task_func fnc, priority prio) {
+      if (prio == priority::normal)
+        return submit(fnc, affinity::any(), false);
+      return schedule(fnc, prio, m_scheduled.no_deadline);
+    }
+
+    // Runs the task before others of its class which have a later or no
+    // deadline. Missing the deadline doesn't drop the task.
+    bool push(task_func fnc, priority prio,
+              std::chrono::steady_clock::time_point deadline) {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          deadline.time_since_epoch());
+      return schedule(fnc, prio,
+                      static_cast<uint64_t>(std::max<int64_t>(ns.count(), 0)));
+    }
+
+    // Tasks queued and not yet running, only counted with a queue limit
+    // or watermarks
+    size_t queued() const noexcept {
+      return m_queued.load(std::memory_order_relaxed);
+    }
+
+    // Tasks turned away or destroyed by the overflow policy
+    uint64_t rejected() const noexcept {
+      return m_rejected.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const noexcept {
+      return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    func_watermark watermark_func(func_watermark fnc) {
+      std::lock_guard lk{m_watermark_lock};
+      std::swap(m_watermark, fnc);
+      return fnc;
+    }
+
+    // How long tasks of the shared queue were queued, by priority. Normal
+    // ones are only counted if they had a deadline.
+    std::array<delay_stats, num_priorities> queue_delays() const {
+      return m_scheduled.stats();
+    }
+
+    // Pushes every task of `fncs`, moving from them, at the cost of about
+    // one push: the injection queue is locked once (not at all from a
+    // worker) and as many parked workers as there are tasks are woken in
+    // one go. Returns how many tasks weren't rejected.
+    template <std::ranges::input_range R>
+    size_t push_bulk(R &&fncs) {
+      std::vector<std::unique_ptr<task_func>> tasks;
+      size_t accepted = 0;
+      for (auto &&f : fncs) {
+        task_func fnc{std::move(f)};
+        M_ASSERT(fnc);
+        if (!fnc)
+          continue;
+        if (!reserve()) {
+          // what was reserved so far has to be queued before waiting
+          accepted += enqueue_bulk(tasks);
+          const auto a = admit(false);
+          if (a == admission::reject)
+            continue;
+          if (a == admission::run) {
+            fnc();
+            accepted++;
+            continue;
+          }
+        }
+        try {
+          tasks.push_back(std::make_unique<task_func>(std::move(fnc)));
+        } catch (...) {
+          dequeued();
+          throw;
         }
-        m_cond.notify_one();
       }
+      return accepted + enqueue_bulk(tasks);
     }
 
-  private:
-    std::mutex m_lock;
-    std::vector<std::jthread> m_threads;
-    std::deque<task_func> m_tasks;
-    std::condition_variable m_cond;
-    bool m_stop;
-
-    void thread_func() {
-      bool running = true;
-      while (running) {
-        task_func task{};
-        {
-          std::unique_lock lk{m_lock};
-          m_cond.wait(lk, [this]() { return m_stop || !m_tasks.empty(); });
-          if (!m_tasks.empty()) {
-            task = std::move(m_tasks.front());
-            m_tasks.pop_front();
+    // Tasks pushed onto a pool which can be waited for together. A thread
+    // waiting for them runs queued tasks of the pool meanwhile instead of
+    // just blocking, so tasks can wait for the tasks they forked without
+    // tying up workers. The first exception thrown by one of the tasks is
+    // rethrown from wait().
+    class wait_group {
+    public:
+      explicit wait_group(thread_pool &pool) noexcept
+          : m_pool{pool}
+          , m_pending{0}
+          , m_failed{false}
+          , m_error{} {
+      }
+
+      ~wait_group() {
+        join();
+      }
+
+      // A task which the pool rejects or drops makes wait() throw
+      template <class F>
+      bool push(F &&fnc) {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        return m_pool.push(
+            [t = ticket{*this}, fnc = std::forward<F>(fnc)]() mutable {
+              t.run(fnc);
+            });
+      }
+
+      uint32_t pending() const noexcept {
+        return m_pending.load(std::memory_order_relaxed);
+      }
+
+      void wait() {
+        join();
+        if (m_failed.exchange(false))
+          std::rethrow_exception(std::exchange(m_error, nullptr));
+      }
+
+    private:
+      // Finishes a task of the group once destroyed, whether it ran or
+      // was dropped by the pool
+      class ticket {
+      public:
+        explicit ticket(wait_group &wg) noexcept : m_group{&wg}, m_ran{false} {
+        }
+
+        ticket(ticket &&other) noexcept
+            : m_group{std::exchange(other.m_group, nullptr)}
+            , m_ran{other.m_ran} {
+        }
+
+        ~ticket() {
+          if (!m_group)
+            return;
+          if (!m_ran) {
+            m_group->fail(std::make_exception_ptr(
+                error{"task was dropped by the thread pool"}));
           }
-          if (m_stop)
-            running = false;
-          lk.unlock();
+          m_group->done();
         }
+
+        template <class F>
+        void run(F &fnc) noexcept {
+          m_ran = true;
+          try {
+            fnc();
+          } catch (...) {
+            m_group->fail(std::current_exception());
+          }
+        }
+
+      private:
+        wait_group *m_group;
+        bool m_ran;
+
+        ticket(ticket const &) = delete;
+        ticket &operator=(ticket const &) = delete;
+      };
+
+      thread_pool &m_pool;
+      std::atomic<uint32_t> m_pending;
+      std::atomic<bool> m_failed;
+      std::exception_ptr m_error; // set by whoever set m_failed
+
+      wait_group(wait_group const &) = delete;
+      wait_group &operator=(wait_group const &) = delete;
+
+      void fail(std::exception_ptr e) noexcept {
+        if (!m_failed.exchange(true))
+          m_error = std::move(e);
+      }
+
+      void done() noexcept {
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          m_pending.notify_all();
+      }
+
+      void join() noexcept {
+        uint32_t idle_rounds = 0;
+        for (;;) {
+          const auto n = m_pending.load(std::memory_order_acquire);
+          if (n == 0)
+            return;
+          if (m_pool.help()) {
+            idle_rounds = 0;
+          } else if (++idle_rounds < spin_rounds) {
+            std::this_thread::yield();
+          } else {
+            // what's left is running on other threads
+            m_pending.wait(n, std::memory_order_acquire);
+            idle_rounds = 0;
+          }
+        }
+      }
+    };
+
+    // Calls `fnc(i)` for every i in [first, last), or `fnc(lo, hi)` for
+    // sub-ranges of at most `grain` indices, and returns once every call
+    // returned. Tasks split the range in halves, keeping one and pushing
+    // the other onto their worker's deque, so idle workers steal the
+    // biggest chunks left and the calling thread pushes one task at most.
+    template <std::integral Index, class F>
+    void parallel_for(Index first, Index last, Index grain, F &&fnc) {
+      if (first >= last)
+        return;
+      grain = std::max<Index>(grain, 1);
+      wait_group wg{*this};
+      if (current_worker()) {
+        split(wg, first, last, grain, fnc);
+      } else {
+        wg.push([this, &wg, first, last, grain, &fnc] {
+          split(wg, first, last, grain, fnc);
+        });
+      }
+      wg.wait();
+    }
+
+  private:
+    pinning m_pin;
+    std::vector<std::unique_ptr<worker>> m_workers; // started or not
+    std::vector<std::unique_ptr<node_state>> m_nodes;
+    std::vector<worker *> m_cpu_workers; // by CPU, null if unassigned
+    inbox m_injected;
+    deadline_queue<task_func, num_priorities> m_scheduled;
+    bool m_counted; // m_queued is kept
+    size_t m_max_queued;
+    overflow m_overflow;
+    size_t m_high_watermark;
+    size_t m_low_watermark;
+    std::atomic<size_t> m_queued;
+    std::atomic<uint32_t> m_blocked; // pushers waiting for room
+    std::atomic<uint64_t> m_rejected;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<bool> m_above_watermark;
+    std::mutex m_watermark_lock;
+    func_watermark m_watermark;
+    std::atomic<uint32_t> m_sleepers;
+    std::atomic<uint32_t> m_size; // the first m_size workers run
+    std::atomic<bool> m_stop;
+    std::mutex m_resize_lock;
+    std::jthread m_monitor; // re-checks default_size()
+
+    struct current {
+      thread_pool *pool;
+      worker *self;
+    };
+
+    static inline thread_local current s_current{nullptr, nullptr};
+
+    thread_pool(thread_pool const &) = delete;
+    thread_pool &operator=(thread_pool const &) = delete;
+
+    void make_nodes(std::vector<uint32_t> cpus) {
+      std::ranges::sort(cpus);
+      for (auto &n : linux::numa::nodes()) {
+        auto state = std::make_unique<node_state>();
+        state->id = n.id;
+        for (auto cpu : n.cpus) {
+          if (cpus.empty() || std::ranges::binary_search(cpus, cpu))
+            state->cpus.push_back(cpu);
+        }
+        if (!state->cpus.empty())
+          m_nodes.push_back(std::move(state));
+      }
+      if (m_nodes.empty())
+        throw error{"thread pool has no CPUs to run on"};
+    }
+
+    void start(worker &w) {
+      if (w.thread.joinable())
+        w.thread.join(); // retired before
+      w.active.store(true);
+      if (m_pin == pinning::none) {
+        w.thread = std::jthread{[this, &w] { thread_func(w); }};
+        return;
+      }
+      // the worker pins itself before it takes a task or allocates, and
+      // only runs if that worked
+      std::promise<void> pinned;
+      auto result = pinned.get_future();
+      w.thread = std::jthread{[this, &w, pinned = std::move(pinned)]() mutable {
+        try {
+          pin(w);
+        } catch (...) {
+          pinned.set_exception(std::current_exception());
+          return;
+        }
+        pinned.set_value();
+        thread_func(w);
+      }};
+      result.get();
+    }
+
+    // Binds the calling thread to the CPUs the worker belongs to
+    void pin(worker const &w) const {
+      if (m_pin == pinning::core)
+        linux::numa::pin_thread(::pthread_self(), {w.cpu});
+      else
+        linux::numa::pin_thread(::pthread_self(), m_nodes[w.node]->cpus);
+    }
+
+    // Hands the tasks of a worker which was retired over to the others
+    void retire(worker &w) {
+      bool moved = false;
+      while (auto *task = w.tasks.pop()) {
+        m_injected.push(task);
+        moved = true;
+      }
+      while (auto *task = w.mailbox.take()) {
+        m_injected.push(task);
+        moved = true;
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (moved && m_sleepers.load(std::memory_order_relaxed) > 0)
+        wake_one(m_nodes[w.node].get());
+    }
+
+    void monitor(std::stop_token st, std::chrono::milliseconds interval) {
+      std::mutex lock;
+      std::condition_variable_any cv;
+      std::unique_lock lk{lock};
+      while (!cv.wait_for(lk, st, interval, [] { return false; })) {
+        if (st.stop_requested())
+          break;
+        try {
+          const auto n = default_size();
+          if (n != size())
+            resize(n);
+        } catch (std::exception const &) {
+          // keep the current size
+        }
+      }
+    }
+
+    void stop() {
+      if (m_monitor.joinable()) {
+        m_monitor.request_stop();
+        m_monitor.join();
+      }
+      std::lock_guard lk{m_resize_lock};
+      m_stop.store(true);
+      for (auto &w : m_workers) {
+        w->epoch.fetch_add(1, std::memory_order_seq_cst);
+        w->epoch.notify_one();
+      }
+      for (auto &w : m_workers) {
+        if (w->thread.joinable())
+          w->thread.join();
+      }
+    }
+
+    enum class admission { queue, reject, run };
+
+    // Takes a place in the queue if there is one
+    bool reserve() noexcept {
+      if (!m_counted)
+        return true;
+      auto n = m_queued.load(std::memory_order_relaxed);
+      do {
+        if (m_max_queued && n >= m_max_queued)
+          return false;
+      } while (!m_queued.compare_exchange_weak(n, n + 1,
+                                               std::memory_order_seq_cst,
+                                               std::memory_order_relaxed));
+      check_watermarks(n + 1);
+      return true;
+    }
+
+    // A task left the queue, to run or dropped
+    void dequeued() noexcept {
+      if (!m_counted)
+        return;
+      const auto n = m_queued.fetch_sub(1, std::memory_order_seq_cst) - 1;
+      // pairs with wait_for_room()
+      if (m_blocked.load(std::memory_order_seq_cst) > 0)
+        m_queued.notify_all();
+      check_watermarks(n);
+    }
+
+    void check_watermarks(size_t n) noexcept {
+      if (m_high_watermark == 0)
+        return;
+      const bool above = m_above_watermark.load(std::memory_order_relaxed);
+      if (above ? n > m_low_watermark : n < m_high_watermark)
+        return;
+      // checked again with the lock held so calls alternate and match the
+      // latest count
+      std::lock_guard lk{m_watermark_lock};
+      n = m_queued.load(std::memory_order_relaxed);
+      if (!m_above_watermark && n >= m_high_watermark) {
+        m_above_watermark = true;
+        if (m_watermark)
+          m_watermark(true);
+      } else if (m_above_watermark && n <= m_low_watermark) {
+        m_above_watermark = false;
+        if (m_watermark)
+          m_watermark(false);
+      }
+    }
+
+    admission admit(bool try_only) {
+      while (!reserve()) {
+        if (try_only) {
+          m_rejected.fetch_add(1, std::memory_order_relaxed);
+          return admission::reject;
+        }
+        switch (m_overflow) {
+          case overflow::reject:
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            return admission::reject;
+          case overflow::caller_runs:
+            return admission::run;
+          case overflow::drop_oldest:
+            if (!drop_oldest())
+              std::this_thread::yield(); // all being taken right now
+            break;
+          case overflow::block:
+            wait_for_room();
+            break;
+        }
+      }
+      return admission::queue;
+    }
+
+    void wait_for_room() {
+      if (current_worker()) {
+        // blocking could leave no worker to make room
+        if (!help())
+          std::this_thread::yield();
+        return;
+      }
+      m_blocked.fetch_add(1, std::memory_order_seq_cst);
+      const auto n = m_queued.load(std::memory_order_seq_cst);
+      if (n >= m_max_queued)
+        m_queued.wait(n, std::memory_order_relaxed);
+      m_blocked.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    bool drop_oldest() {
+      auto *task = m_injected.take();
+      for (auto &n : m_nodes) {
         if (task)
-          task();
+          break;
+        task = n->tasks.take();
+        for (auto *w : n->workers) {
+          if (task)
+            break;
+          task = w->tasks.steal();
+          if (!task)
+            task = w->mailbox.take();
+        }
+      }
+      if (!task)
+        task = m_scheduled.shed();
+      if (!task)
+        return false;
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      dequeued();
+      delete task;
+      return true;
+    }
+
+    bool submit(task_func &fnc, affinity aff, bool try_only) {
+      M_ASSERT(fnc);
+      if (M_UNLIKELY(!fnc))
+        return false;
+      switch (admit(try_only)) {
+        case admission::reject:
+          return false;
+        case admission::run:
+          fnc();
+          return true;
+        case admission::queue:
+          break;
+      }
+      try {
+        enqueue(std::make_unique<task_func>(std::move(fnc)), aff);
+      } catch (...) {
+        dequeued();
+        throw;
+      }
+      return true;
+    }
+
+    void enqueue(std::unique_ptr<task_func> task, affinity aff) {
+      auto *self = current_worker();
+      worker *target = nullptr;   // the worker of a core
+      node_state *home = nullptr; // of the worker to wake up
+      if (aff.m_kind == affinity::kind::core) {
+        if (aff.m_id < m_cpu_workers.size())
+          target = m_cpu_workers[aff.m_id];
+        if (target)
+          home = m_nodes[target->node].get();
+        if (target && !target->active.load(std::memory_order_relaxed))
+          target = nullptr; // retired, any worker of the node will do
+      } else if (aff.m_kind == affinity::kind::node) {
+        home = find_node(aff.m_id);
+      }
+      // unknown nodes and cores count as no preference
+      if (self && (target ? target == self
+                          : !home || home == m_nodes[self->node].get())) {
+        self->tasks.push(task.get());
+        home = m_nodes[self->node].get();
+      } else if (target) {
+        target->mailbox.push(task.get());
+      } else if (home) {
+        home->tasks.push(task.get());
+      } else {
+        m_injected.push(task.get());
+      }
+      task.release();
+      // pairs with park(), either a worker sees the task or this sees the
+      // worker parked
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_sleepers.load(std::memory_order_relaxed) == 0)
+        return;
+      if (!target || !wake(*target))
+        wake_one(home);
+    }
+
+    // Queues tasks which already have their places, returns how many
+    size_t enqueue_bulk(std::vector<std::unique_ptr<task_func>> &tasks) {
+      const auto n = tasks.size();
+      if (n == 0)
+        return 0;
+      node_state *home = nullptr;
+      if (auto *self = current_worker()) {
+        for (auto &task : tasks) {
+          self->tasks.push(task.get());
+          task.release();
+        }
+        home = m_nodes[self->node].get();
+      } else {
+        m_injected.push_bulk(tasks);
+      }
+      tasks.clear();
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      for (size_t i = 0; i < n; i++) {
+        if (m_sleepers.load(std::memory_order_relaxed) == 0 ||
+            !wake_one(home)) {
+          break;
+        }
+      }
+      return n;
+    }
+
+    bool schedule(task_func &fnc, priority prio, uint64_t deadline) {
+      M_ASSERT(fnc);
+      if (M_UNLIKELY(!fnc))
+        return false;
+      switch (admit(false)) {
+        case admission::reject:
+          return false;
+        case admission::run:
+          fnc();
+          return true;
+        case admission::queue:
+          break;
+      }
+      try {
+        auto task = std::make_unique<task_func>(std::move(fnc));
+        m_scheduled.push(task.get(), static_cast<size_t>(prio), deadline,
+                         time::monotonic_ns());
+        task.release();
+      } catch (...) {
+        dequeued();
+        throw;
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_sleepers.load(std::memory_order_relaxed) > 0)
+        wake_one(nullptr);
+      return true;
+    }
+
+    // A task of the shared queue which goes before plain ones: a high
+    // priority one, a normal one with a deadline, or one which aged into
+    // these classes
+    task_func *take_first() {
+      if (m_scheduled.empty())
+        return nullptr;
+      const auto now = time::monotonic_ns();
+      constexpr auto normal = static_cast<size_t>(priority::normal);
+      if (!m_scheduled.has(normal, now))
+        return nullptr;
+      return m_scheduled.take(now, normal);
+    }
+
+    task_func *take_scheduled() {
+      if (m_scheduled.empty())
+        return nullptr;
+      return m_scheduled.take(time::monotonic_ns());
+    }
+
+    template <class Index, class F>
+    void split(wait_group &wg, Index lo, Index hi, Index grain, F &fnc) {
+      while (hi - lo > grain) {
+        const Index mid = lo + (hi - lo) / 2;
+        wg.push([this, &wg, mid, hi, grain, &fnc] {
+          split(wg, mid, hi, grain, fnc);
+        });
+        hi = mid;
+      }
+      if constexpr (std::is_invocable_v<F &, Index, Index>) {
+        fnc(lo, hi);
+      } else {
+        for (auto i = lo; i < hi; i++)
+          fnc(i);
+      }
+    }
+
+    // Runs a queued task on the calling thread, for threads waiting on a
+    // wait_group
+    bool help() {
+      auto *w = current_worker();
+      auto *task = w ? find_task(*w) : find_task();
+      if (!task)
+        return false;
+      dequeued();
+      std::unique_ptr<task_func> owned{task};
+      (*owned)();
+      return true;
+    }
+
+    node_state *find_node(uint32_t id) const noexcept {
+      for (auto const &n : m_nodes) {
+        if (n->id == id)
+          return n.get();
+      }
+      return nullptr;
+    }
+
+    worker *current_worker() const noexcept {
+      return s_current.pool == this ? s_current.self : nullptr;
+    }
+
+    bool wake(worker &w) noexcept {
+      if (!w.parked.exchange(false))
+        return false;
+      w.epoch.fetch_add(1, std::memory_order_seq_cst);
+      w.epoch.notify_one();
+      return true;
+    }
+
+    // Wakes a parked worker, preferably one of `home`
+    bool wake_one(node_state *home) noexcept {
+      if (home) {
+        for (auto *w : home->workers) {
+          if (wake(*w))
+            return true;
+        }
+      }
+      for (auto &w : m_workers) {
+        if (wake(*w))
+          return true;
+      }
+      return false;
+    }
+
+    // Takes a task from another worker, the oldest from its deque or one
+    // waiting in its mailbox
+    task_func *steal(worker &w, std::vector<worker *> const &victims) {
+      const auto n = victims.size();
+      if (n == 0)
+        return nullptr;
+      // xorshift
+      w.rng ^= w.rng << 13;
+      w.rng ^= w.rng >> 7;
+      w.rng ^= w.rng << 17;
+      const auto start = static_cast<size_t>(w.rng % n);
+      for (size_t i = 0; i < n; i++) {
+        auto &victim = *victims[(start + i) % n];
+        if (&victim == &w)
+          continue;
+        if (auto *task = victim.tasks.steal())
+          return task;
+        if (auto *task = victim.mailbox.take())
+          return task;
+      }
+      return nullptr;
+    }
+
+    task_func *find_task(worker &w) {
+      if (auto *task = take_first())
+        return task;
+      if (auto *task = w.tasks.pop())
+        return task;
+      if (auto *task = w.mailbox.take(&w.tasks, injected_batch))
+        return task;
+      auto &home = *m_nodes[w.node];
+      if (auto *task = home.tasks.take(&w.tasks, injected_batch))
+        return task;
+      if (auto *task = m_injected.take(&w.tasks, injected_batch))
+        return task;
+      if (auto *task = steal(w, home.workers))
+        return task;
+      // other nodes only once this one ran dry, a task at a time
+      for (auto &n : m_nodes) {
+        if (n.get() == &home)
+          continue;
+        if (auto *task = n->tasks.take())
+          return task;
+        if (auto *task = steal(w, n->workers))
+          return task;
+      }
+      return take_scheduled();
+    }
+
+    // For threads which aren't workers of the pool, a task at a time
+    task_func *find_task() {
+      if (auto *task = take_first())
+        return task;
+      if (auto *task = m_injected.take())
+        return task;
+      for (auto &n : m_nodes) {
+        if (auto *task = n->tasks.take())
+          return task;
+        for (auto *w : n->workers) {
+          if (auto *task = w->tasks.steal())
+            return task;
+          if (auto *task = w->mailbox.take())
+            return task;
+        }
+      }
+      return take_scheduled();
+    }
+
+    bool has_work() const noexcept {
+      if (!m_injected.empty() || !m_scheduled.empty())
+        return true;
+      for (auto const &n : m_nodes) {
+        if (!n->tasks.empty())
+          return true;
+      }
+      for (auto const &w : m_workers) {
+        if (!w->tasks.empty() || !w->mailbox.empty())
+          return true;
+      }
+      return false;
+    }
+
+    void park(worker &w) {
+      m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+      w.parked.store(true, std::memory_order_seq_cst);
+      const auto epoch = w.epoch.load(std::memory_order_seq_cst);
+      if (!has_work() && !m_stop.load() && w.active.load())
+        w.epoch.wait(epoch, std::memory_order_seq_cst);
+      w.parked.store(false, std::memory_order_relaxed);
+      m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void thread_func(worker &w) {
+      s_current = {this, &w};
+      uint32_t idle_rounds = 0;
+      for (;;) {
+        if (!w.active.load(std::memory_order_relaxed)) {
+          retire(w);
+          break;
+        }
+        if (auto *task = find_task(w)) {
+          dequeued();
+          std::unique_ptr<task_func> owned{task};
+          (*owned)();
+          idle_rounds = 0;
+          continue;
+        }
+        if (m_stop.load())
+          break; // nothing left anywhere
+        if (++idle_rounds < spin_rounds) {
+          std::this_thread::yield();
+          continue;
+        }
+        park(w);
+        idle_rounds = 0;
       }
+      s_current = {nullptr, nullptr};
     }
   };
 
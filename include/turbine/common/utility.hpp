@@ -58,6 +58,34 @@ namespace turbine {
       return now<nanoseconds>();
     }
 
+    // Like now() but never goes backwards, for measuring intervals
+    template <class DurT>
+    inline auto monotonic() {
+      auto now = steady_clock::now().time_since_epoch();
+      return static_cast<uint64_t>(duration_cast<DurT>(now).count());
+    }
+
+    inline auto monotonic_ns() {
+      return monotonic<nanoseconds>();
+    }
+
+    // Reads a POSIX clock directly, e.g. CLOCK_MONOTONIC_COARSE which is
+    // cheaper than CLOCK_MONOTONIC but only as precise as the kernel tick
+    inline uint64_t clock_ns(clockid_t clk) noexcept {
+      timespec ts{};
+      ::clock_gettime(clk, &ts);
+      return static_cast<uint64_t>(ts.tv_sec) * 1000000000 +
+             static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    inline uint64_t clock_resolution_ns(clockid_t clk) noexcept {
+      timespec ts{};
+      if (::clock_getres(clk, &ts) != 0)
+        return 1;
+      return static_cast<uint64_t>(ts.tv_sec) * 1000000000 +
+             static_cast<uint64_t>(ts.tv_nsec);
+    }
+
   } // namespace time
 
 } // namespace turbine
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <turbine/common/macros.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace turbine::common {
+
+  // Lock-free work-stealing deque of pointers (Chase-Lev). The owning
+  // thread pushes and pops at the bottom, any thread can steal from the
+  // top. Grows as needed; arrays which were outgrown are kept until the
+  // deque is destroyed since a thief may still be reading one. The first
+  // array is only made by the first push, on the owner's thread, so its
+  // memory is local to wherever the owner runs.
+  template <class T>
+  class work_deque {
+    class array {
+    public:
+      explicit array(size_t capacity)
+          : m_mask{capacity - 1}
+          , m_slots{new std::atomic<T *>[capacity]} {
+      }
+
+      size_t capacity() const noexcept {
+        return m_mask + 1;
+      }
+
+      T *get(int64_t i) const noexcept {
+        return m_slots[static_cast<size_t>(i) & m_mask].load(
+            std::memory_order_relaxed);
+      }
+
+      void put(int64_t i, T *item) noexcept {
+        m_slots[static_cast<size_t>(i) & m_mask].store(
+            item, std::memory_order_relaxed);
+      }
+
+    private:
+      size_t m_mask;
+      std::unique_ptr<std::atomic<T *>[]> m_slots;
+    };
+
+  public:
+    static constexpr const size_t default_capacity = 256; // power of 2
+
+    explicit work_deque(size_t capacity = default_capacity)
+        : m_top{0}
+        , m_bottom{0}
+        , m_array{nullptr}
+        , m_arrays{}
+        , m_capacity{capacity} {
+      M_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    }
+
+    // Owner only
+    void push(T *item) {
+      const auto b = m_bottom.load(std::memory_order_relaxed);
+      const auto t = m_top.load(std::memory_order_acquire);
+      auto *a = m_array.load(std::memory_order_relaxed);
+      if (!a || b - t >= static_cast<int64_t>(a->capacity()))
+        a = grow(a, t, b);
+      a->put(b, item);
+      m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only, takes the most recently pushed item or returns nullptr
+    T *pop() noexcept {
+      const auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+      auto *a = m_array.load(std::memory_order_relaxed);
+      m_bottom.store(b, std::memory_order_seq_cst);
+      auto t = m_top.load(std::memory_order_seq_cst);
+      if (t > b) {
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr; // empty
+      }
+      auto *item = a->get(b);
+      if (t == b) {
+        // last item, race the thieves for it
+        if (!m_top.compare_exchange_strong(t, t + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+          item = nullptr;
+        }
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+      }
+      return item;
+    }
+
+    // Any thread, takes the oldest item or returns nullptr if there is
+    // none or another thread got it first
+    T *steal() noexcept {
+      auto t = m_top.load(std::memory_order_seq_cst);
+      const auto b = m_bottom.load(std::memory_order_seq_cst);
+      if (t >= b)
+        return nullptr;
+      auto *item = m_array.load(std::memory_order_acquire)->get(t);
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+        return nullptr;
+      }
+      return item;
+    }
+
+    // Approximate when other threads are pushing or stealing
+    bool empty() const noexcept {
+      const auto b = m_bottom.load(std::memory_order_seq_cst);
+      const auto t = m_top.load(std::memory_order_seq_cst);
+      return b <= t;
+    }
+
+  private:
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    std::atomic<array *> m_array;
+    std::vector<std::unique_ptr<array>> m_arrays; // owner only
+    size_t m_capacity; // of the first array
+
+    work_deque(work_deque const &) = delete;
+    work_deque &operator=(work_deque const &) = delete;
+
+    array *grow(array *old, int64_t t, int64_t b) {
+      if (!old) {
+        m_arrays.push_back(std::make_unique<array>(m_capacity));
+        m_array.store(m_arrays.back().get(), std::memory_order_release);
+        return m_arrays.back().get();
+      }
+      auto bigger = std::make_unique<array>(old->capacity() * 2);
+      for (auto i = t; i < b; i++)
+        bigger->put(i, old->get(i));
+      auto *a = bigger.get();
+      m_arrays.push_back(std::move(bigger));
+      m_array.store(a, std::memory_order_release);
+      return a;
+    }
+  };
+
+} // namespace turbine::common
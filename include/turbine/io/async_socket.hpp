@@ -0,0 +1,312 @@
+#pragma once
+
+#include <turbine/common/error.hpp>
+#include <turbine/common/macros.hpp>
+#include <turbine/io/loop.hpp>
+#include <turbine/io/poll_source.hpp>
+#include <turbine/net/address.hpp>
+#include <turbine/net/socket.hpp>
+
+#include <cassert>
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ranges>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+namespace turbine::io {
+
+  // Awaitable I/O on a socket. The socket is made non-blocking and watched
+  // edge-triggered by a single poll_source, each operation is first tried
+  // right away and only suspends on EAGAIN. Suspended coroutines are
+  // resumed directly from the poll_source's dispatch. At most one read (or
+  // accept) and one write can be pending at a time.
+  class async_socket {
+    enum class slot : uint8_t {
+      reader,
+      writer,
+    };
+
+    class operation {
+      friend class async_socket;
+
+    protected:
+      operation(async_socket &sock) noexcept
+          : m_sock{sock}
+          , m_handle{}
+          , m_error{0} {
+      }
+
+      ~operation() = default;
+
+      // Returns true once the operation completed or failed
+      virtual bool perform() noexcept = 0;
+
+      void check_error() const {
+        if (m_error)
+          throw system_error{m_error};
+      }
+
+      int fileno() const noexcept {
+        return m_sock.m_socket->fileno();
+      }
+
+      async_socket &m_sock;
+      std::coroutine_handle<> m_handle;
+      int m_error;
+
+    private:
+      operation(operation const &) = delete;
+      operation &operator=(operation const &) = delete;
+    };
+
+    // Waits in one of the socket's two operation slots
+    template <slot S>
+    class slot_operation : public operation {
+    public:
+      bool await_ready() noexcept {
+        return perform();
+      }
+
+      void await_suspend(std::coroutine_handle<> h) noexcept {
+        assert(!m_sock.pending(S));
+        m_handle = h;
+        m_sock.pending(S) = this;
+      }
+
+    protected:
+      using operation::operation;
+
+      ~slot_operation() {
+        // destroyed while suspended
+        if (m_sock.pending(S) == this)
+          m_sock.pending(S) = nullptr;
+      }
+    };
+
+  public:
+    using ptr = std::shared_ptr<async_socket>;
+    using poll_events = poll_source::poll_events;
+
+    class read_operation final : public slot_operation<slot::reader> {
+    public:
+      read_operation(async_socket &sock, void *data, size_t count) noexcept
+          : slot_operation{sock}
+          , m_data{data}
+          , m_count{count}
+          , m_result{0} {
+      }
+
+      // Number of bytes read, 0 at end of file
+      size_t await_resume() const {
+        check_error();
+        return m_result;
+      }
+
+    private:
+      void *m_data;
+      size_t m_count;
+      size_t m_result;
+
+      bool perform() noexcept final {
+        for (;;) {
+          if (auto n = ::recv(fileno(), m_data, m_count, 0); n >= 0) {
+            m_result = static_cast<size_t>(n);
+            return true;
+          }
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+          m_error = errno;
+          return true;
+        }
+      }
+    };
+
+    class write_operation final : public slot_operation<slot::writer> {
+    public:
+      write_operation(async_socket &sock, void const *data,
+                      size_t count) noexcept
+          : slot_operation{sock}
+          , m_data{static_cast<std::byte const *>(data)}
+          , m_count{count}
+          , m_done{0} {
+      }
+
+      // Completes once all of the data was sent, returns its size
+      size_t await_resume() const {
+        check_error();
+        return m_done;
+      }
+
+    private:
+      std::byte const *m_data;
+      size_t m_count;
+      size_t m_done;
+
+      bool perform() noexcept final {
+        while (m_done < m_count) {
+          auto n = ::send(fileno(), m_data + m_done, m_count - m_done,
+                          MSG_NOSIGNAL);
+          if (n >= 0) {
+            m_done += static_cast<size_t>(n);
+            continue;
+          }
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+          m_error = errno;
+          return true;
+        }
+        return true;
+      }
+    };
+
+    template <class T>
+    class accept_operation final : public slot_operation<slot::reader> {
+    public:
+      accept_operation(async_socket &sock) noexcept
+          : slot_operation{sock}
+          , m_fd{-1}
+          , m_addr{}
+          , m_addr_len{sizeof m_addr} {
+      }
+
+      ~accept_operation() {
+        if (m_fd >= 0)
+          ::close(m_fd);
+      }
+
+      // The accepted socket, already non-blocking
+      std::shared_ptr<T> await_resume() {
+        check_error();
+        net::address addr{&m_addr, m_addr_len};
+        auto sock = m_sock.socket().template make<T>(m_fd, addr);
+        m_fd = -1;
+        return sock;
+      }
+
+    private:
+      int m_fd;
+      ::sockaddr_storage m_addr;
+      ::socklen_t m_addr_len;
+
+      bool perform() noexcept final {
+        for (;;) {
+          m_fd = ::accept4(fileno(), reinterpret_cast<::sockaddr *>(&m_addr),
+                           &m_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+          if (m_fd >= 0)
+            return true;
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+          m_error = errno;
+          return true;
+        }
+      }
+    };
+
+    async_socket(io::loop &loop, net::socket_ptr sock)
+        : m_loop{loop}
+        , m_socket{std::move(sock)}
+        , m_source{}
+        , m_reader{nullptr}
+        , m_writer{nullptr} {
+      assert(m_socket);
+      m_socket->fcntl(F_SETFL, m_socket->fcntl(F_GETFL) | O_NONBLOCK);
+      const auto events =
+          poll_events::in | poll_events::out | poll_events::read_hangup;
+      m_source = m_loop.add_poll(
+          m_socket, events, poll_source::input_flags::edge_triggered,
+          [this](auto events) { return on_ready(events); });
+    }
+
+    ~async_socket() {
+      m_loop.remove(*m_source);
+    }
+
+    net::socket &socket() noexcept {
+      return *m_socket;
+    }
+
+    net::socket const &socket() const noexcept {
+      return *m_socket;
+    }
+
+    read_operation read(void *data, size_t count) noexcept {
+      return read_operation{*this, data, count};
+    }
+
+    template <std::ranges::contiguous_range R>
+    read_operation read(R &&buf) noexcept {
+      return read(std::ranges::data(buf),
+                  std::ranges::size(buf) *
+                      sizeof(std::ranges::range_value_t<R>));
+    }
+
+    write_operation write(void const *data, size_t count) noexcept {
+      return write_operation{*this, data, count};
+    }
+
+    template <std::ranges::contiguous_range R>
+    write_operation write(R const &buf) noexcept {
+      return write(std::ranges::data(buf),
+                   std::ranges::size(buf) *
+                       sizeof(std::ranges::range_value_t<R>));
+    }
+
+    template <class T = net::socket>
+    accept_operation<T> accept() noexcept {
+      return accept_operation<T>{*this};
+    }
+
+  private:
+    io::loop &m_loop;
+    net::socket_ptr m_socket;
+    poll_source_ptr m_source;
+    operation *m_reader;
+    operation *m_writer;
+
+    async_socket(async_socket const &) = delete;
+    async_socket &operator=(async_socket const &) = delete;
+
+    operation *&pending(slot s) noexcept {
+      return s == slot::reader ? m_reader : m_writer;
+    }
+
+    // Takes an operation out of its slot if it can complete now
+    static std::coroutine_handle<> complete(operation *&slot) noexcept {
+      if (!slot || !slot->perform())
+        return {};
+      auto h = slot->m_handle;
+      slot = nullptr;
+      return h;
+    }
+
+    source::result on_ready(poll_events events) {
+      const auto failed = poll_events::error | poll_events::hangup;
+      const auto readable = poll_events::in | poll_events::read_hangup;
+      std::coroutine_handle<> reader{}, writer{};
+      if ((events & (readable | failed)) != poll_events::none)
+        reader = complete(m_reader);
+      if ((events & (poll_events::out | failed)) != poll_events::none)
+        writer = complete(m_writer);
+      // either may destroy this socket, don't touch it afterwards
+      if (reader)
+        reader.resume();
+      if (writer)
+        writer.resume();
+      return source::result::keep_going;
+    }
+  };
+
+  using async_socket_ptr = async_socket::ptr;
+
+} // namespace turbine::io
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <turbine/common/error.hpp>
+#include <turbine/linux/epoll.hpp>
+#include <turbine/linux/timerfd.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+namespace turbine::io {
+
+  // Readiness notification mechanism behind io::loop. Whatever the
+  // backend, events are reported in epoll's format with data.ptr set to
+  // the pointer the file descriptor was added with, and the event masks
+  // and input flags are epoll's. Wait timeouts are in nanoseconds.
+  class backend {
+  public:
+    using ptr = std::unique_ptr<backend>;
+
+    enum class type : uint8_t {
+      epoll,
+      io_uring,
+    };
+
+    virtual ~backend() = default;
+
+    virtual enum type type() const noexcept = 0;
+
+    virtual void add(int fd, uint32_t events, void *data) = 0;
+
+    virtual void mod(int fd, uint32_t events, void *data) = 0;
+
+    virtual void del(int fd) = 0;
+
+    virtual uint32_t wait(epoll_event *events, uint32_t max_events,
+                          int64_t timeout_ns) = 0;
+  };
+
+  using backend_ptr = backend::ptr;
+
+  // Uses epoll_pwait2() for sub-millisecond timeouts. Kernels without it
+  // get a timerfd in the epoll set instead, which is armed whenever the
+  // timeout isn't a whole number of milliseconds.
+  class epoll_backend final : public backend {
+  public:
+    epoll_backend(linux::epoll::flags fl = linux::epoll::flags::none)
+        : m_ep{fl}
+        , m_timer{}
+        , m_have_pwait2{true} {
+    }
+
+    enum type type() const noexcept final {
+      return type::epoll;
+    }
+
+    void add(int fd, uint32_t events, void *data) final {
+      m_ep.add(fd, make_event(events, data));
+    }
+
+    void mod(int fd, uint32_t events, void *data) final {
+      m_ep.mod(fd, make_event(events, data));
+    }
+
+    void del(int fd) final {
+      m_ep.del(fd);
+    }
+
+    uint32_t wait(epoll_event *events, uint32_t max_events,
+                  int64_t timeout_ns) final {
+      std::span<epoll_event> buf{events, max_events};
+      if (timeout_ns % 1000000 == 0 || timeout_ns < 0)
+        return filter_timer(buf, m_ep.wait(buf, to_ms(timeout_ns)));
+      if (m_have_pwait2) {
+        try {
+          return m_ep.pwait2(buf, timeout_ns);
+        } catch (system_error const &e) {
+          // seccomp filters, e.g. Docker's default one, fail it with EPERM
+          if (e.code() != ENOSYS && e.code() != EPERM)
+            throw;
+          m_have_pwait2 = false;
+        }
+      }
+      arm_timer(timeout_ns);
+      return filter_timer(buf, m_ep.wait(buf, -1));
+    }
+
+  private:
+    linux::epoll m_ep;
+    std::unique_ptr<linux::timerfd> m_timer; // created on first use
+    bool m_have_pwait2;
+
+    static epoll_event make_event(uint32_t events, void *data) noexcept {
+      epoll_event ev{};
+      ev.events = events;
+      ev.data.ptr = data;
+      return ev;
+    }
+
+    static int64_t to_ms(int64_t timeout_ns) noexcept {
+      if (timeout_ns < 0)
+        return -1;
+      return std::min<int64_t>(timeout_ns / 1000000, INT32_MAX);
+    }
+
+    void arm_timer(int64_t timeout_ns) {
+      if (!m_timer) {
+        m_timer = std::make_unique<linux::timerfd>(
+            linux::timerfd::clock::monotonic,
+            linux::timerfd::flags::close_on_exec |
+                linux::timerfd::flags::non_blocking);
+        // edge-triggered, re-arming resets the expiration so it never
+        // needs to be read
+        m_ep.add(m_timer->fileno(),
+                 make_event(EPOLLIN | EPOLLET, m_timer.get()));
+      }
+      m_timer->set(std::chrono::nanoseconds{timeout_ns});
+    }
+
+    // The timer only serves to wake up, it's never reported
+    uint32_t filter_timer(std::span<epoll_event> buf, uint32_t n) noexcept {
+      if (!m_timer)
+        return n;
+      for (uint32_t i = 0; i < n; i++) {
+        if (buf[i].data.ptr == m_timer.get()) {
+          buf[i] = buf[--n];
+          break;
+        }
+      }
+      return n;
+    }
+  };
+
+} // namespace turbine::io
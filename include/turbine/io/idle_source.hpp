@@ -3,35 +3,55 @@
 #include <turbine/common/macros.hpp>
 #include <turbine/io/source.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
-#include <functional>
+#include <utility>
 
 namespace turbine::io {
 
   class loop;
 
+  // Runs when the loop has nothing else to do: no timer expired and no
+  // other source was ready in the iteration. While an idle source is due
+  // the loop doesn't block. A callback which found no work calls
+  // mark_idle(), and with a backoff set the source then sleeps, twice as
+  // long each time up to the maximum, until a run does find work.
   class idle_source final : public source {
     friend class loop;
 
   public:
     using ptr = pointer_type<idle_source>;
-    using callback = std::function<result()>;
-    using callback_self = std::function<result(idle_source &)>;
+    using callback = common::inplace_function<result()>;
+    using callback_self = common::inplace_function<result(idle_source &)>;
 
-    idle_source(io::loop &loop, callback cb)
-        : idle_source{loop, [cb = std::move(cb)](auto &) {
-                        if (M_LIKELY(cb))
-                          return cb();
-                        return result::keep_going;
-                      }} {
+    // `cb` is a callable like callback or callback_self
+    template <class F>
+      requires(is_callback<F> || is_callback<F, idle_source &>)
+    idle_source(io::loop &loop, F &&cb)
+        : source{loop, priority::highest, wrap(std::forward<F>(cb))}
+        , m_backoff_min{0}
+        , m_backoff_max{0}
+        , m_delay{0}
+        , m_next_run{0}
+        , m_idle{false} {
     }
 
-    idle_source(io::loop &loop, callback_self cb)
-        : source{loop, priority::highest, [this, cb = std::move(cb)](auto &) {
-                   if (M_LIKELY(cb))
-                     return cb(*this);
-                   return result::keep_going;
-                 }} {
+    // Enables the adaptive backoff, `min` 0 disables it
+    void backoff(std::chrono::nanoseconds min, std::chrono::nanoseconds max) {
+      m_backoff_min = to_ns(min);
+      m_backoff_max = std::max(m_backoff_min, to_ns(max));
+      m_delay = std::min(m_delay, m_backoff_max);
+    }
+
+    // Called from the callback when there was nothing to do
+    void mark_idle() noexcept {
+      m_idle = true;
+    }
+
+    // Current backoff delay, 0 while the source finds work
+    std::chrono::nanoseconds delay() const noexcept {
+      return std::chrono::nanoseconds{m_delay};
     }
 
   protected:
@@ -40,12 +60,55 @@ namespace turbine::io {
     }
 
     bool prepare(int64_t &timeout_ms) final {
-      timeout_ms = 0; // no wait needed
-      return true;    // ignored by io::loop
+      const auto rem = remaining_ns();
+      timeout_ms = static_cast<int64_t>((rem + 999999) / 1000000);
+      return rem == 0;
     }
 
     bool check() final {
-      return true; // always ready
+      return remaining_ns() == 0;
+    }
+
+  private:
+    uint64_t m_backoff_min; // nanoseconds
+    uint64_t m_backoff_max;
+    uint64_t m_delay;
+    uint64_t m_next_run; // monotonic nanoseconds
+    bool m_idle;         // set by mark_idle() during the callback
+
+    static uint64_t to_ns(std::chrono::nanoseconds d) noexcept {
+      return static_cast<uint64_t>(std::max<int64_t>(d.count(), 0));
+    }
+
+    // defined in loop.hpp as it needs the loop's cached time
+    uint64_t remaining_ns() const noexcept;
+
+    bool is_due(uint64_t now) const noexcept {
+      return m_next_run <= now;
+    }
+
+    // Called by the loop after the callback ran at `now`
+    void finish(uint64_t now) noexcept {
+      if (m_idle && m_backoff_min > 0)
+        m_delay = m_delay ? std::min(m_delay * 2, m_backoff_max)
+                          : m_backoff_min;
+      else
+        m_delay = 0;
+      m_next_run = now + m_delay;
+      m_idle = false;
+    }
+
+    template <class F>
+    static source::callback wrap(F &&cb) {
+      if constexpr (is_callback<F, idle_source &>) {
+        return [cb = std::forward<F>(cb)](source &self) mutable -> result {
+          return cb(static_cast<idle_source &>(self));
+        };
+      } else {
+        return [cb = std::forward<F>(cb)](source &) mutable -> result {
+          return cb();
+        };
+      }
     }
   };
 
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <turbine/io/async_socket.hpp>
+#include <turbine/io/backend.hpp>
 #include <turbine/io/idle_source.hpp>
 #include <turbine/io/loop.hpp>
 #include <turbine/io/poll_source.hpp>
 #include <turbine/io/source.hpp>
+#include <turbine/io/source_group.hpp>
+#include <turbine/io/static_loop.hpp>
+#include <turbine/io/task.hpp>
 #include <turbine/io/timeout_source.hpp>
+#include <turbine/io/timer_wheel.hpp>
+#include <turbine/io/uring_backend.hpp>
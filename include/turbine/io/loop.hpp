@@ -1,85 +1,293 @@
 #pragma once
 
 #include <turbine/common/error.hpp>
+#include <turbine/common/inplace_function.hpp>
 #include <turbine/common/macros.hpp>
+#include <turbine/common/mpsc_queue.hpp>
+#include <turbine/common/thread_pool.hpp>
+#include <turbine/io/backend.hpp>
 #include <turbine/io/idle_source.hpp>
 #include <turbine/io/poll_source.hpp>
 #include <turbine/io/source.hpp>
+#include <turbine/io/source_group.hpp>
+#include <turbine/io/task.hpp>
 #include <turbine/io/timeout_source.hpp>
+#include <turbine/io/timer_wheel.hpp>
+#include <turbine/io/uring_backend.hpp>
 #include <turbine/linux/epoll.hpp>
+#include <turbine/linux/eventfd.hpp>
 #include <turbine/posix/fd.hpp>
 
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
 #include <cassert>
 #include <chrono>
+#include <coroutine>
+#include <cstddef>
 #include <cstdint>
 #include <exception>
-#include <functional>
-#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <vector>
 
 namespace turbine::io {
 
   class loop {
-    using event_map = std::unordered_map<int, poll_source_ptr>;
-    using ep_events = std::array<epoll_event, 1024>;
+    using ep_events = std::vector<epoll_event>;
 
-    class source_wrapper {
+    static constexpr const uint32_t shrink_after = 64;
+
+    // Ready sources are queued by kind and then by priority, one bucket per
+    // named source::priority level. Priorities in between the named levels
+    // share the bucket of the named level above them.
+    static constexpr const size_t num_priorities = 5;
+    static constexpr const size_t num_kinds = 3;
+    static constexpr const uint32_t priority_step = UINT8_MAX / 4;
+
+    // Ready sources are referenced without taking ownership, an entry is
+    // stale if its source was removed (or removed and added again) after it
+    // was queued. Removed sources stay alive until the iteration is over.
+    struct ready_entry {
+      source *src;
+      uint32_t generation;
+
+      bool is_stale() const noexcept {
+        return !src->m_attached || src->m_generation != generation;
+      }
+    };
+
+    // Intrusive list of attached sources of one kind. An attached source
+    // owns itself through m_self, so adding and removing one is O(1) and
+    // touches no reference count.
+    class source_list {
     public:
-      source_wrapper(source_ptr src) : m_id{next_id()}, m_src{std::move(src)} {
-        assert(m_src);
+      source_list() noexcept : m_head{nullptr}, m_tail{nullptr} {
+      }
+
+      bool empty() const noexcept {
+        return m_head == nullptr;
       }
 
-      source *operator->() {
-        return m_src.get();
+      source *front() const noexcept {
+        return m_head;
       }
 
-      source const *operator->() const {
-        return m_src.get();
+      source *back() const noexcept {
+        return m_tail;
       }
 
-      source_ptr operator*() {
-        return m_src;
+      void push_back(source &src) noexcept {
+        src.m_prev = m_tail;
+        src.m_next = nullptr;
+        if (m_tail)
+          m_tail->m_next = &src;
+        else
+          m_head = &src;
+        m_tail = &src;
       }
 
-      bool operator<(source_wrapper const &other) const noexcept {
-        assert(m_src);
-        assert(other.m_src);
-        const auto p1 = m_src->priority_level();
-        const auto p2 = other.m_src->priority_level();
-        return (p1 < p2) || (p1 == p2 && m_id < other.m_id);
+      void erase(source &src) noexcept {
+        if (src.m_prev)
+          src.m_prev->m_next = src.m_next;
+        else
+          m_head = src.m_next;
+        if (src.m_next)
+          src.m_next->m_prev = src.m_prev;
+        else
+          m_tail = src.m_prev;
+        src.m_prev = nullptr;
+        src.m_next = nullptr;
+      }
+
+      template <class F>
+      void for_each(F &&fnc) const {
+        for (auto *src = m_head; src; src = src->m_next)
+          fnc(*src);
       }
 
     private:
-      uint64_t m_id;
-      source_ptr m_src;
+      source *m_head;
+      source *m_tail;
+
+      source_list(source_list const &) = delete;
+      source_list &operator=(source_list const &) = delete;
+    };
+
+    using ready_list = std::vector<ready_entry>;
+
+    // FIFO of ready sources. Entries left over when a time budget ran out
+    // stay queued ahead of the next iteration's. Taken entries are only
+    // dropped from the front once they are at least half of the storage,
+    // so a queue which never drains stays bounded at O(1) amortized cost.
+    class ready_queue {
+    public:
+      ready_queue() noexcept : m_entries{}, m_head{0} {
+      }
 
-      static uint64_t next_id() {
-        static std::atomic<uint64_t> id_{0};
-        return id_++;
+      bool empty() const noexcept {
+        return m_head == m_entries.size();
       }
+
+      void push_back(ready_entry e) {
+        if (m_head > 0 && m_head >= m_entries.size() / 2) {
+          m_entries.erase(m_entries.begin(),
+                          m_entries.begin() + static_cast<ptrdiff_t>(m_head));
+          m_head = 0;
+        }
+        m_entries.push_back(e);
+      }
+
+      ready_entry pop_front() noexcept {
+        assert(!empty());
+        const auto e = m_entries[m_head++];
+        if (m_head == m_entries.size()) {
+          m_entries.clear();
+          m_head = 0;
+        }
+        return e;
+      }
+
+    private:
+      ready_list m_entries;
+      size_t m_head; // entries before it were taken
     };
 
-    using source_list = std::vector<source_wrapper>;
+    using ready_buckets =
+        std::array<ready_queue, num_kinds * num_priorities>;
+    using timer_list = std::vector<timeout_source *>;
 
   public:
-    using func_setup = std::function<void(void)>;
-    using func_teardown = std::function<void(void)>;
-    using func_error = std::function<bool(turbine::exception const &)>;
+    using func_setup = common::inplace_function<void(void)>;
+    using func_teardown = common::inplace_function<void(void)>;
+    using func_error =
+        common::inplace_function<bool(turbine::exception const &)>;
+    using task_func = common::inplace_function<void(void)>;
+
+    struct options {
+      // bounds for the epoll_wait() event buffer, which is resized between
+      // them based on how many events are reported
+      size_t min_events = 64;
+      size_t max_events = 4096;
+      // number of epoll_wait() batches taken back-to-back in one iteration
+      // while the event buffer keeps filling up
+      uint32_t max_batches = 1;
+      // readiness backend, epoll or io_uring (Linux 5.13+)
+      enum backend::type backend_type = backend::type::epoll;
+      uint32_t uring_entries = uring_backend::default_entries;
+      // sample CLOCK_MONOTONIC_COARSE instead of CLOCK_MONOTONIC, cheaper
+      // to read but timers are only as precise as the kernel tick
+      bool coarse_clock = false;
+      // time an iteration may spend dispatching ready sources, 0 for no
+      // limit. Sources still ready when it runs out are dispatched first
+      // in the next iteration, timers are never held back.
+      std::chrono::nanoseconds dispatch_budget{0};
+      // idle sources run per iteration at most, in turns
+      uint32_t idle_batch = 16;
+      // the same per source::priority level, from highest to lowest
+      std::array<std::chrono::nanoseconds, num_priorities> priority_budget{};
+      // dispatch ready sources by weighted fair queueing across their
+      // groups (FIFO within a group) instead of by priority, see
+      // source_group. Only the per-iteration budget applies then.
+      bool fair_queueing = false;
+      // threads of the pool made for offload() if none was given, 0 for
+      // the pool's default size (CPUs allowed by affinity and quota)
+      uint32_t offload_threads = 0;
+    };
+
+    struct statistics {
+      uint64_t interest_updates;    // modify() calls and one-shot re-arms
+      uint64_t epoll_ctl_calls;     // EPOLL_CTL_MOD actually issued
+      uint64_t epoll_ctl_coalesced; // updates which needed no syscall
+      uint64_t drain_batches;       // extra epoll_wait() batches taken
+      uint64_t budget_exhausted;    // iterations cut short by the budget
+      // the same for each priority level's budget
+      std::array<uint64_t, num_priorities> priority_budget_exhausted;
+    };
 
     loop(linux::epoll::flags ep_fl = linux::epoll::flags::none)
+        : loop{options{}, ep_fl} {
+    }
+
+    loop(options const &opts,
+         linux::epoll::flags ep_fl = linux::epoll::flags::none)
         : m_running{false}
         , m_exit_code{0}
-        , m_ep{ep_fl}
-        , m_map{}
+        , m_options{opts}
+        , m_iteration{0}
+        , m_frames{}
+        , m_clock{opts.coarse_clock ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC}
+        , m_clock_resolution{time::clock_resolution_ns(m_clock)}
+        , m_now{time::clock_ns(m_clock)}
+        , m_backend{make_backend(opts, ep_fl)}
         , m_events{}
-        , m_sources{}
+        , m_small_batches{0}
+        , m_poll_sources{}
+        , m_idle_sources{}
         , m_ready_sources{}
+        , m_ready_mask{0}
+        , m_budgeted{false}
+        , m_dispatch_start{0}
+        , m_priority_spent{}
+        , m_timed{false}
+        , m_groups{}
+        , m_group_ready{}
+        , m_fair_groups{}
+        , m_virtual_time{0}
+        , m_dispatches{0}
+        , m_idle_batch{}
+        , m_carried_sources{}
+        , m_timeouts{}
+        , m_timers{m_now}
+        , m_rearm_timers{}
+        , m_expired_timers{}
+        , m_removed{}
+        , m_dirty_sources{}
+        , m_stats{}
         , m_setup{}
         , m_teardown{}
-        , m_error{} {
+        , m_error{}
+        , m_thread{}
+        , m_tasks{}
+        , m_task_batch{}
+        , m_wakeup_fd{linux::eventfd::make(
+              0, linux::eventfd::flags::close_on_exec |
+                     linux::eventfd::flags::non_blocking)}
+        , m_wakeup{}
+        , m_pool{nullptr}
+        , m_own_pool{}
+        , m_detached{nullptr} {
+      m_options.min_events = std::max<size_t>(m_options.min_events, 1);
+      m_options.max_events = std::clamp<size_t>(
+          m_options.max_events, m_options.min_events, INT32_MAX);
+      m_options.max_batches = std::max<uint32_t>(m_options.max_batches, 1);
+      m_budgeted = m_options.dispatch_budget.count() > 0 ||
+                   std::ranges::any_of(m_options.priority_budget,
+                                       [](auto b) { return b.count() > 0; });
+      m_timed = m_budgeted || m_options.fair_queueing;
+      add_group();
+      m_events.resize(m_options.min_events);
+      m_wakeup = emplace<poll_source>(
+          m_wakeup_fd, poll_source::poll_events::in,
+          [this](auto) {
+            run_tasks();
+            return source::result::keep_going;
+          },
+          source::priority::highest);
+    }
+
+    ~loop() {
+      m_own_pool.reset(); // finishes offloaded work first
+      while (m_detached) {
+        std::coroutine_handle<detached::promise_type>::from_promise(
+            *m_detached)
+            .destroy();
+      }
+      release_all();
     }
 
     func_setup setup_func(func_setup fnc) noexcept {
@@ -97,33 +305,100 @@ namespace turbine::io {
       return fnc;
     }
 
+    // Exceptions thrown by callbacks, spawned tasks and posted functions
+    // go to the error handler, those not derived from turbine::exception
+    // wrapped in a turbine::error. If there is no handler or it returns
+    // false the exception is rethrown from here, after the teardown, and
+    // the loop can be run again.
     int run() {
       if (m_running)
         throw error{"event loop is already running"};
       m_running = true;
       m_exit_code = 0;
-      if (m_setup)
-        m_setup();
-      while (m_running) {
-        if (!m_error)
-          iterate();
-        else {
-          try {
+      m_thread = std::this_thread::get_id();
+      frame_pool::scope frames{m_frames};
+      try {
+        update_now();
+        if (m_setup)
+          m_setup();
+        while (m_running) {
+          if (!m_error)
             iterate();
-          } catch (turbine::exception const &e) {
-            if (!m_error(e))
-              throw e;
-          }
+          else
+            iterate_guarded();
         }
+      } catch (...) {
+        m_running = false;
+        finish();
+        throw;
       }
-      if (m_teardown)
-        m_teardown();
+      finish();
       return m_exit_code;
     }
 
+    // Can be called from any thread
     void quit(int exit_code) {
-      m_running = false;
       m_exit_code = exit_code;
+      m_running = false;
+      if (m_thread.load() != std::this_thread::get_id())
+        m_wakeup_fd->write();
+    }
+
+    // Queues `fnc` to run on the loop's thread in its next iteration, can be
+    // called from any thread. Only the first post after the loop took the
+    // queued tasks has to wake it up, and all of them run in one batch.
+    void post(task_func fnc) {
+      M_ASSERT(fnc);
+      if (m_tasks.push(std::move(fnc)))
+        m_wakeup_fd->write();
+    }
+
+    // Pool which offload() runs work on. Unless one was set, a pool is
+    // made with options::offload_threads threads the first time it's
+    // needed. A pool set here must not be destroyed while work offloaded
+    // to it is still running, nor may the loop.
+    common::thread_pool &pool() {
+      if (!m_pool) {
+        m_own_pool =
+            std::make_unique<common::thread_pool>(m_options.offload_threads);
+        m_pool = m_own_pool.get();
+      }
+      return *m_pool;
+    }
+
+    void pool(common::thread_pool &p) noexcept {
+      m_pool = &p;
+    }
+
+    // Runs `fnc` on the pool and then `on_done` on the loop's thread, with
+    // the result of `fnc` if it returns one. Completions go through the
+    // same queue as post(), so any number of them finishing between two
+    // iterations cost the loop a single wakeup. If `fnc` throws, the
+    // exception is rethrown from the loop's next iteration instead and
+    // `on_done` isn't called. The same goes for work which a bounded pool
+    // drops, see common::thread_pool::options::max_queued. Returns false,
+    // and nothing else, if the pool rejected the work right away.
+    template <class F, class D>
+    bool offload(F &&fnc, D &&on_done) {
+      using R = std::invoke_result_t<std::decay_t<F> &>;
+      auto on_drop = [] {
+        throw error{"offloaded work was dropped by the thread pool"};
+      };
+      return push_guarded(on_drop, [this, fnc = std::forward<F>(fnc),
+                                    done = std::forward<D>(on_done)]() mutable {
+        try {
+          if constexpr (std::is_void_v<R>) {
+            fnc();
+            post(std::move(done));
+          } else {
+            post([done = std::move(done), r = fnc()]() mutable {
+              done(std::move(r));
+            });
+          }
+        } catch (...) {
+          post([e = std::current_exception()] { std::rethrow_exception(e); });
+        }
+      });
     }
 
     template <class T, class... Args>
@@ -149,19 +424,36 @@ namespace turbine::io {
       return emplace<poll_source>(std::forward<Args>(args)...);
     }
 
+    // Safe to call from a callback, including the removed source's own. The
+    // source is kept alive until the current iteration is done with it.
     bool remove(source &src) {
-      if (src.kind() == source::kind::poll) {
-        int fd = static_cast<poll_source *>(&src)->fileno();
-        m_ep.del(fd);
-        m_map.erase(fd);
-      }
-      for (size_t i = 0; i < m_sources.size(); ++i) {
-        if ((*m_sources[i]).get() == &src) {
-          m_sources.erase(m_sources.begin() + i);
-          return true;
+      if (!src.m_attached)
+        return false;
+      src.m_attached = false;
+      switch (src.kind()) {
+        case source::kind::timeout:
+          m_timers.cancel(*static_cast<timeout_source *>(&src));
+          m_timeouts.erase(src);
+          break;
+        case source::kind::poll: {
+          auto &s = static_cast<poll_source &>(src);
+          m_backend->del(s.fileno());
+          // these lists outlive the iteration, don't leave the source behind
+          if (s.m_carried_slot)
+            m_carried_sources[s.m_carried_slot - 1].src = nullptr;
+          if (s.m_dirty_slot)
+            m_dirty_sources[s.m_dirty_slot - 1] = nullptr;
+          s.m_carried_slot = 0;
+          s.m_dirty_slot = 0;
+          m_poll_sources.erase(src);
+          break;
         }
+        case source::kind::idle:
+          m_idle_sources.erase(src);
+          break;
       }
-      return false;
+      m_removed.push_back(std::move(src.m_self));
+      return true;
     }
 
     bool remove(source_ptr src) {
@@ -170,112 +462,914 @@ namespace turbine::io {
       return false;
     }
 
+    // Changes what a poll source watches. The change is applied right before
+    // the loop next waits for events, so several changes to the same source
+    // within an iteration cost at most one epoll_ctl() call, or none if they
+    // cancel each other out.
+    bool modify(poll_source &src, poll_source::poll_events events) {
+      return modify(src, events, src.m_input_flags);
+    }
+
+    bool modify(poll_source &src, poll_source::poll_events events,
+                poll_source::input_flags in_flags) {
+      src.m_watch_events = events;
+      src.m_input_flags = in_flags;
+      if (!src.m_attached)
+        return false;
+      mark_dirty(src);
+      return true;
+    }
+
+    // Suspends the awaiting coroutine for `timeout`, it is resumed from the
+    // dispatch of a timeout_source
+    class sleep_awaiter {
+    public:
+      sleep_awaiter(io::loop &loop, std::chrono::nanoseconds timeout)
+          : m_loop{loop}
+          , m_timeout{timeout}
+          , m_source{} {
+      }
+
+      ~sleep_awaiter() {
+        if (m_source)
+          m_loop.remove(*m_source);
+      }
+
+      bool await_ready() const noexcept {
+        return m_timeout.count() <= 0;
+      }
+
+      void await_suspend(std::coroutine_handle<> h) {
+        m_source = m_loop.add_timeout(m_timeout, [h] {
+          h.resume();
+          return source::result::remove;
+        });
+      }
+
+      void await_resume() const noexcept {
+      }
+
+    private:
+      io::loop &m_loop;
+      std::chrono::nanoseconds m_timeout;
+      timeout_source_ptr m_source;
+
+      sleep_awaiter(sleep_awaiter const &) = delete;
+      sleep_awaiter &operator=(sleep_awaiter const &) = delete;
+    };
+
+    // Suspends the awaiting coroutine while a function runs on the pool,
+    // it is resumed on the loop's thread with the function's result or
+    // exception. If a bounded pool rejects or drops the function, it is
+    // resumed with an error instead.
+    template <class R>
+    class offload_awaiter {
+      using value_type = std::conditional_t<std::is_void_v<R>, std::monostate,
+                                            R>;
+
+    public:
+      template <class F>
+      offload_awaiter(io::loop &loop, F &&fnc)
+          : m_loop{loop}
+          , m_func{std::forward<F>(fnc)}
+          , m_result{} {
+      }
+
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      bool await_suspend(std::coroutine_handle<> h) {
+        auto on_drop = [this, h] {
+          m_result.template emplace<2>(std::make_exception_ptr(
+              error{"offloaded work was dropped by the thread pool"}));
+          h.resume();
+        };
+        const bool queued = m_loop.push_guarded(on_drop, [this, h] {
+          try {
+            if constexpr (std::is_void_v<R>) {
+              m_func();
+              m_result.template emplace<1>();
+            } else {
+              m_result.template emplace<1>(m_func());
+            }
+          } catch (...) {
+            m_result.template emplace<2>(std::current_exception());
+          }
+          m_loop.post([h] { h.resume(); });
+        });
+        if (!queued) {
+          m_result.template emplace<2>(std::make_exception_ptr(
+              error{"offloaded work was rejected by the thread pool"}));
+        }
+        return queued;
+      }
+
+      R await_resume() {
+        if (m_result.index() == 2)
+          std::rethrow_exception(std::get<2>(m_result));
+        assert(m_result.index() == 1);
+        if constexpr (!std::is_void_v<R>)
+          return std::move(std::get<1>(m_result));
+      }
+
+    private:
+      io::loop &m_loop;
+      common::inplace_function<R(void)> m_func;
+      std::variant<std::monostate, value_type, std::exception_ptr> m_result;
+
+      offload_awaiter(offload_awaiter const &) = delete;
+      offload_awaiter &operator=(offload_awaiter const &) = delete;
+    };
+
+    template <class F>
+    auto offload(F &&fnc) {
+      using R = std::invoke_result_t<std::decay_t<F> &>;
+      return offload_awaiter<R>{*this, std::forward<F>(fnc)};
+    }
+
+    template <class Rep, class Period>
+    sleep_awaiter sleep(std::chrono::duration<Rep, Period> timeout) {
+      return sleep_awaiter{
+          *this,
+          std::chrono::duration_cast<std::chrono::nanoseconds>(timeout)};
+    }
+
+    // Starts `t` right away and lets it run to completion on its own. If it
+    // throws, the exception is rethrown from the loop's next iteration. A
+    // task still suspended when the loop is destroyed is destroyed too.
+    void spawn(task<void> t) {
+      run_detached(*this, std::move(t));
+    }
+
+    statistics const &stats() const noexcept {
+      return m_stats;
+    }
+
+    // Entries of the event buffer, between options::min_events and
+    // options::max_events
+    size_t event_capacity() const noexcept {
+      return m_events.size();
+    }
+
+    // Makes a group for fair queueing, see source_group
+    source_group_ptr add_group(uint32_t weight = 1) {
+      const auto index = static_cast<uint32_t>(m_groups.size());
+      source_group_ptr grp{new source_group{index, weight}};
+      m_group_ready.emplace_back();
+      m_groups.push_back(grp);
+      return grp;
+    }
+
+    // Group of the sources which weren't given one
+    source_group &default_group() noexcept {
+      return *m_groups.front();
+    }
+
+    // Monotonic time in nanoseconds, sampled once per iteration (and after
+    // waiting for events) so sources don't each have to read the clock.
+    // Timeouts are scheduled relative to it.
+    uint64_t now() const noexcept {
+      return m_now;
+    }
+
+    // Number of the iteration running, counting from 1
+    uint64_t iteration() const noexcept {
+      return m_iteration;
+    }
+
+    // Samples the clock again, e.g. before scheduling a timeout from a
+    // callback which ran for a long time
+    uint64_t update_now() noexcept {
+      m_now = time::clock_ns(m_clock);
+      return m_now;
+    }
+
+    // Restarts the timeout from now, optionally with a new interval
+    bool reschedule(timeout_source &src) {
+      return reschedule(src, src.interval());
+    }
+
+    bool reschedule(timeout_source &src, uint64_t timeout_ms) {
+      return reschedule(src, std::chrono::milliseconds{timeout_ms});
+    }
+
+    bool reschedule(timeout_source &src, std::chrono::nanoseconds interval) {
+      if (!src.m_attached)
+        return false;
+      src.m_interval =
+          static_cast<uint64_t>(std::max(interval.count(), int64_t{0}));
+      m_timers.schedule(src, m_now + src.m_interval);
+      return true;
+    }
+
   private:
-    bool m_running;
-    int m_exit_code;
-    linux::epoll m_ep;
-    event_map m_map;
+    // Coroutine owning a spawned task until it finishes. Unfinished ones
+    // are listed in their loop, which destroys them when it is destroyed.
+    struct detached {
+      struct promise_type {
+        io::loop &m_loop;
+        promise_type *m_prev;
+        promise_type *m_next;
+
+        promise_type(io::loop &loop, task<void> &) noexcept
+            : m_loop{loop}
+            , m_prev{nullptr}
+            , m_next{loop.m_detached} {
+          if (m_next)
+            m_next->m_prev = this;
+          loop.m_detached = this;
+        }
+
+        ~promise_type() {
+          if (m_prev)
+            m_prev->m_next = m_next;
+          else
+            m_loop.m_detached = m_next;
+          if (m_next)
+            m_next->m_prev = m_prev;
+        }
+
+        static void *operator new(size_t size) {
+          return frame_pool::allocate(size);
+        }
+
+        static void operator delete(void *ptr) noexcept {
+          frame_pool::deallocate(ptr);
+        }
+
+        detached get_return_object() const noexcept {
+          return {};
+        }
+
+        std::suspend_never initial_suspend() const noexcept {
+          return {};
+        }
+
+        std::suspend_never final_suspend() const noexcept {
+          return {};
+        }
+
+        void return_void() const noexcept {
+        }
+
+        void unhandled_exception() {
+          m_loop.post([e = std::current_exception()] {
+            std::rethrow_exception(e);
+          });
+        }
+      };
+    };
+
+    // Travels with offloaded work and posts `on_drop` to the loop if the
+    // pool destroys the work without running it, like wait_group::ticket.
+    // The guard being pushed is followed through its moves, so that work
+    // which push() rejects, and reports by returning false, isn't reported
+    // a second time.
+    template <class F>
+    class drop_guard {
+    public:
+      drop_guard(io::loop &loop, F on_drop)
+          : m_loop{&loop}
+          , m_on_drop{std::move(on_drop)} {
+      }
+
+      drop_guard(drop_guard &&other) noexcept
+          : m_loop{std::exchange(other.m_loop, nullptr)}
+          , m_on_drop{std::move(other.m_on_drop)} {
+        if (s_pushing == &other)
+          s_pushing = this;
+      }
+
+      ~drop_guard() {
+        if (s_pushing == this)
+          s_pushing = nullptr; // rejected while being pushed
+        else if (m_loop)
+          m_loop->post(std::move(m_on_drop));
+      }
+
+      // The work is running, nothing to report
+      void release() noexcept {
+        m_loop = nullptr;
+      }
+
+      static void pushing(drop_guard *guard) noexcept {
+        s_pushing = guard;
+      }
+
+    private:
+      static inline thread_local drop_guard *s_pushing = nullptr;
+
+      io::loop *m_loop;
+      F m_on_drop;
+
+      drop_guard(drop_guard const &) = delete;
+      drop_guard &operator=(drop_guard const &) = delete;
+    };
+
+    // Pushes `fnc` to the pool along with a guard for `on_drop`
+    template <class D, class F>
+    bool push_guarded(D on_drop, F &&fnc) {
+      drop_guard guard{*this, std::move(on_drop)};
+      decltype(guard)::pushing(&guard);
+      const bool queued = pool().push(
+          [guard = std::move(guard), fnc = std::forward<F>(fnc)]() mutable {
+            guard.release();
+            fnc();
+          });
+      decltype(guard)::pushing(nullptr);
+      return queued;
+    }
+
+    std::atomic<bool> m_running;
+    std::atomic<int> m_exit_code;
+    options m_options;
+    uint64_t m_iteration;
+    frame_pool m_frames; // outlives the sources
+    clockid_t m_clock;
+    uint64_t m_clock_resolution;
+    uint64_t m_now;
+    backend_ptr m_backend;
     ep_events m_events;
-    source_list m_sources;
-    source_list m_ready_sources;
+    uint32_t m_small_batches;
+    source_list m_poll_sources;
+    source_list m_idle_sources;
+    ready_buckets m_ready_sources;
+    uint32_t m_ready_mask; // non-empty buckets
+    bool m_budgeted;       // any dispatch budget set
+    uint64_t m_dispatch_start;
+    std::array<uint64_t, num_priorities> m_priority_spent;
+    bool m_timed;                          // callbacks are timed
+    std::vector<source_group_ptr> m_groups; // the first is the default
+    std::vector<ready_queue> m_group_ready;
+    std::vector<source_group *> m_fair_groups; // with ready sources
+    uint64_t m_virtual_time; // of the group dispatched last
+    uint64_t m_dispatches;
+    ready_list m_idle_batch;
+    ready_list m_carried_sources;
+    source_list m_timeouts;
+    timer_wheel m_timers;
+    timer_list m_rearm_timers;
+    timer_list m_expired_timers; // being dispatched
+    std::vector<source_ptr> m_removed; // released after the iteration
+    std::vector<poll_source *> m_dirty_sources; // null once removed
+    statistics m_stats;
     func_setup m_setup;
     func_teardown m_teardown;
     func_error m_error;
+    std::atomic<std::thread::id> m_thread; // running the loop
+    common::mpsc_queue<task_func> m_tasks;
+    common::mpsc_queue<task_func>::batch m_task_batch;
+    linux::eventfd_ptr m_wakeup_fd;
+    poll_source_ptr m_wakeup;
+    common::thread_pool *m_pool; // for offload()
+    std::unique_ptr<common::thread_pool> m_own_pool;
+    detached::promise_type *m_detached; // spawned tasks still suspended
+
+    static detached run_detached(io::loop &, task<void> t) {
+      co_await std::move(t);
+    }
 
     bool add(source_ptr src) {
       assert(src);
-      switch (src->kind()) {
-        case source::kind::timeout:
+      auto &added = *src;
+      if (added.m_attached)
+        return false;
+      switch (added.kind()) {
+        case source::kind::timeout: {
+          auto &t = static_cast<timeout_source &>(added);
+          m_timers.schedule(t, m_now + t.m_interval);
+          m_timeouts.push_back(added);
+          break;
+        }
         case source::kind::idle: {
-          for (auto &s : m_sources) {
-            if ((*s).get() == src.get())
-              return false;
-          }
-          m_sources.emplace_back(src);
-          return true;
+          m_idle_sources.push_back(added);
+          break;
         }
         case source::kind::poll: {
-          auto s = std::static_pointer_cast<poll_source>(src);
-          assert(s);
-          int fno = s->fileno();
-          epoll_event ev{};
-          ev.data.fd = fno;
-          ev.events = static_cast<uint32_t>(s->m_watch_events);
-          m_ep.add(fno, ev);
-          if (m_map.emplace(fno, std::move(s)).second) {
-            m_sources.emplace_back(s);
-            return true;
-          }
-          return false;
+          auto &s = static_cast<poll_source &>(added);
+          s.m_ready_events = poll_source::poll_events::none;
+          s.m_pending_events = poll_source::poll_events::none;
+          const auto events = interest(s);
+          m_backend->add(s.fileno(), events, &s);
+          s.m_armed_events = events;
+          m_poll_sources.push_back(added);
+          break;
         }
       }
+      added.m_attached = true;
+      added.m_queued = false;
+      added.m_generation++;
+      added.m_self = std::move(src);
+      return true;
+    }
+
+    void iterate_guarded() {
+      try {
+        iterate();
+      } catch (turbine::exception const &e) {
+        if (!m_error(e))
+          throw;
+      } catch (std::exception const &e) {
+        if (!m_error(error{e.what()}))
+          throw;
+      } catch (...) {
+        if (!m_error(error{"unknown exception"}))
+          throw;
+      }
+    }
+
+    // Runs the teardown function, the loop counts as stopped afterwards
+    // even if it throws
+    void finish() {
+      try {
+        if (m_teardown)
+          m_teardown();
+      } catch (...) {
+        m_thread = std::thread::id{};
+        throw;
+      }
+      m_thread = std::thread::id{};
+    }
+
+    void release_all() noexcept {
+      m_timers.clear();
+      for (auto *list : {&m_timeouts, &m_poll_sources, &m_idle_sources}) {
+        while (auto *src = list->front()) {
+          list->erase(*src);
+          src->m_attached = false;
+          auto self = std::move(src->m_self);
+        }
+      }
+    }
+
+    static backend_ptr make_backend(options const &opts,
+                                    linux::epoll::flags ep_fl) {
+      switch (opts.backend_type) {
+        case backend::type::epoll:
+          return std::make_unique<epoll_backend>(ep_fl);
+        case backend::type::io_uring:
+          return std::make_unique<uring_backend>(opts.uring_entries);
+      }
       M_UNREACHABLE();
     }
 
-    void sort_sources(source_list &sources) {
-      std::sort(std::begin(sources), std::end(sources));
+    static uint32_t interest(poll_source const &src) noexcept {
+      return static_cast<uint32_t>(src.m_watch_events) |
+             static_cast<uint32_t>(src.m_input_flags);
     }
 
-    void iterate() {
+    // Called after a poll source was dispatched and wants to keep going
+    void finish_poll(poll_source &src) {
+      if (!src.m_attached)
+        return;
+      if (src.m_pending_events != poll_source::poll_events::none) {
+        // stopped before EAGAIN, dispatch again without waiting for epoll
+        carry(src);
+      } else if (src.is_one_shot()) {
+        mark_dirty(src);
+      }
+    }
+
+    void carry(poll_source &src) {
+      if (src.m_carried_slot)
+        return;
+      m_carried_sources.push_back({&src, src.m_generation});
+      src.m_carried_slot = static_cast<uint32_t>(m_carried_sources.size());
+    }
+
+    void mark_dirty(poll_source &src) {
+      m_stats.interest_updates++;
+      if (src.m_dirty_slot) {
+        m_stats.epoll_ctl_coalesced++;
+        return;
+      }
+      m_dirty_sources.push_back(&src);
+      src.m_dirty_slot = static_cast<uint32_t>(m_dirty_sources.size());
+    }
+
+    // Applies the net interest change of each modified source
+    void flush_interest() {
+      while (!m_dirty_sources.empty()) {
+        auto *src = m_dirty_sources.back();
+        m_dirty_sources.pop_back();
+        if (!src)
+          continue; // removed
+        src->m_dirty_slot = 0;
+        const auto events = interest(*src);
+        if (events == src->m_armed_events) {
+          m_stats.epoll_ctl_coalesced++;
+          continue;
+        }
+        m_backend->mod(src->fileno(), events, src);
+        src->m_armed_events = events;
+        m_stats.epoll_ctl_calls++;
+      }
+    }
+
+    void run_tasks() {
+      m_wakeup_fd->read();
+      try {
+        // finish a batch interrupted by an exception first
+        while (!m_task_batch.empty())
+          m_task_batch.pop()();
+        m_task_batch = m_tasks.take_all();
+        while (!m_task_batch.empty())
+          m_task_batch.pop()();
+      } catch (...) {
+        m_wakeup_fd->write(); // come back for the rest
+        throw;
+      }
+    }
+
+    // Timers which weren't rescheduled or removed by their callback go
+    // on from their previous deadline
+    void rearm_timers() {
+      for (auto *t : m_rearm_timers) {
+        if (t->m_attached && !t->is_scheduled())
+          m_timers.schedule(*t, t->m_next_expires);
+      }
+      m_rearm_timers.clear();
+    }
+
+    static bool fires_before(timeout_source const *a,
+                             timeout_source const *b) noexcept {
+      if (a->deadline_ns() != b->deadline_ns())
+        return a->deadline_ns() < b->deadline_ns();
+      return a->sequence() < b->sequence();
+    }
+
+    // Timers which expired together come off the wheel in no particular
+    // order, they are run by deadline and then in the order they were set
+    void dispatch_timers() {
+      // finish a batch interrupted by an exception in a previous iteration
+      rearm_timers();
+      m_timers.advance(m_now);
+      for (;;) {
+        while (auto *n = m_timers.pop_expired())
+          m_expired_timers.push_back(static_cast<timeout_source *>(n));
+        if (m_expired_timers.empty())
+          break;
+        std::ranges::sort(m_expired_timers, fires_before);
+        size_t next = 0;
+        try {
+          while (next < m_expired_timers.size()) {
+            auto *t = m_expired_timers[next++];
+            // removed or rescheduled by an earlier callback
+            if (!t->m_attached || t->is_scheduled())
+              continue;
+            t->expire(m_now);
+            m_rearm_timers.push_back(t);
+            if (run_callback(*t) == source::result::remove)
+              remove(*t);
+          }
+        } catch (...) {
+          // the others are still due, for the next iteration
+          for (; next < m_expired_timers.size(); next++) {
+            auto *t = m_expired_timers[next];
+            if (t->m_attached && !t->is_scheduled())
+              m_timers.schedule(*t, t->deadline_ns());
+          }
+          m_expired_timers.clear();
+          throw;
+        }
+        m_expired_timers.clear();
+      }
+      if (!m_rearm_timers.empty()) {
+        rearm_timers();
+        update_now(); // account for the callbacks in the next timeout
+      }
+    }
+
+    static int64_t min_timeout(int64_t a, int64_t b) noexcept {
+      if (a < 0 || b < 0)
+        return std::max(a, b);
+      return std::min(a, b);
+    }
+
+    // Nanoseconds until the nearest idle source is due, or -1 if there is
+    // none. A source which was just added is due right away.
+    int64_t idle_timeout() const noexcept {
       int64_t timeout = -1;
+      m_idle_sources.for_each([this, &timeout](source &src) {
+        const auto next = static_cast<idle_source &>(src).m_next_run;
+        const auto rem =
+            static_cast<int64_t>(next > m_now ? next - m_now : 0);
+        timeout = timeout < 0 ? rem : std::min(timeout, rem);
+      });
+      return timeout;
+    }
+
+    // Runs a batch of the due idle sources, taking turns across iterations
+    // by moving each one visited to the back of the list
+    void dispatch_idle() {
+      m_idle_batch.clear();
+      const auto limit = std::max<uint32_t>(m_options.idle_batch, 1);
+      auto *last = m_idle_sources.back();
+      for (auto *src = m_idle_sources.front();
+           src && m_idle_batch.size() < limit;) {
+        auto *next = src == last ? nullptr : src->m_next;
+        if (static_cast<idle_source *>(src)->is_due(m_now)) {
+          m_idle_batch.push_back({src, src->m_generation});
+          m_idle_sources.erase(*src);
+          m_idle_sources.push_back(*src);
+        }
+        src = next;
+      }
+      for (auto const &e : m_idle_batch) {
+        if (e.is_stale())
+          continue;
+        auto &src = static_cast<idle_source &>(*e.src);
+        const auto res = run_callback(src);
+        update_now();
+        src.finish(m_now);
+        if (res == source::result::remove)
+          remove(src);
+      }
+    }
+
+    // Nanoseconds until the nearest timer from now, or -1 if there is none
+    int64_t timer_timeout() const noexcept {
+      auto timeout = m_timers.next_timeout();
+      if (timeout <= 0)
+        return timeout;
+      const auto elapsed = m_now - m_timers.now();
+      if (elapsed >= static_cast<uint64_t>(timeout))
+        return 0;
+      timeout -= static_cast<int64_t>(elapsed);
+      // a coarse clock may lag the wake-up by a tick, don't spin on it
+      return std::max(timeout, static_cast<int64_t>(m_clock_resolution));
+    }
 
-      m_ready_sources.clear();
-
-      // step 1: prepare
-      for (auto &src : m_sources) {
-        int64_t to = -1;
-        if (src->prepare(to) && src->kind() != source::kind::idle) {
-          m_ready_sources.push_back(src);
-        } else {
-          // FIXME: re-write this logic better
-          if (to < 0 && timeout < 0) {
-            // no change
-          } else if (timeout < 0 && to >= 0) {
-            timeout = to;
-          } else if (to >= 0 && to < timeout) {
-            timeout = to;
+    static size_t ready_bucket(source const &src) noexcept {
+      const auto kind = static_cast<size_t>(src.kind());
+      const auto pri = static_cast<uint32_t>(src.m_priority);
+      const auto level =
+          std::min<size_t>(pri / priority_step, num_priorities - 1);
+      return kind * num_priorities + level;
+    }
+
+    // Buckets are taken in order and each one in FIFO order, so there is
+    // nothing to sort. Callbacks don't queue sources, only collecting does.
+    // Returns false once the iteration's dispatch budget ran out
+    bool dispatch_ready() {
+      if (m_options.fair_queueing)
+        return dispatch_fair();
+      auto pending = m_ready_mask;
+      while (pending) {
+        const auto idx = static_cast<size_t>(std::countr_zero(pending));
+        pending &= pending - 1;
+        auto &bucket = m_ready_sources[idx];
+        const auto level = idx % num_priorities;
+        while (!bucket.empty()) {
+          if (m_budgeted) {
+            const auto spent = m_now - m_dispatch_start;
+            if (exceeds(spent, m_options.dispatch_budget)) {
+              m_stats.budget_exhausted++;
+              return false;
+            }
+            if (exceeds(m_priority_spent[level],
+                        m_options.priority_budget[level])) {
+              m_stats.priority_budget_exhausted[level]++;
+              break;
+            }
           }
+          const auto e = bucket.pop_front();
+          if (e.is_stale())
+            continue;
+          dispatch_one(*e.src, level);
         }
+        if (bucket.empty())
+          m_ready_mask &= ~(uint32_t{1} << idx);
       }
+      return true;
+    }
 
-      // step 2: dispatch already ready sources
-      if (!m_ready_sources.empty()) {
-        sort_sources(m_ready_sources);
-        for (auto &src : m_ready_sources) {
-          if (src->dispatch() == source::result::remove)
-            remove(*src);
+    // Weighted fair queueing: the ready group which is furthest behind in
+    // virtual time goes next. A group which had nothing ready catches up
+    // to the current virtual time, so it can't save up a share for later.
+    bool dispatch_fair() {
+      while (!m_fair_groups.empty()) {
+        if (m_budgeted &&
+            exceeds(m_now - m_dispatch_start, m_options.dispatch_budget)) {
+          m_stats.budget_exhausted++;
+          return false;
+        }
+        auto next = std::ranges::min_element(
+            m_fair_groups, {}, [](auto *g) { return g->m_vtime; });
+        auto *grp = *next;
+        auto &queue = m_group_ready[grp->m_index];
+        const auto e = queue.pop_front();
+        if (queue.empty()) {
+          *next = m_fair_groups.back();
+          m_fair_groups.pop_back();
         }
-        m_ready_sources.clear();
+        if (e.is_stale())
+          continue;
+        m_virtual_time = grp->m_vtime;
+        dispatch_one(*e.src, num_priorities);
+      }
+      return true;
+    }
+
+    void push_fair(source &src) {
+      auto *grp = src.m_group ? src.m_group : m_groups.front().get();
+      auto &queue = m_group_ready[grp->m_index];
+      if (queue.empty()) {
+        grp->m_vtime = std::max(grp->m_vtime, m_virtual_time);
+        m_fair_groups.push_back(grp);
       }
+      queue.push_back({&src, src.m_generation});
+    }
 
-      // step 3: poll file descriptors
-      if (timeout < 0)
-        timeout = -1;
-      auto n = m_ep.wait(m_events, timeout);
+    // Runs a source's callback and accounts for it in the source's group
+    source::result run_callback(source &src) {
+      auto &grp = src.m_group ? *src.m_group : *m_groups.front();
+      const auto start = m_now;
+      const auto res = src.dispatch();
+      m_dispatches++;
+      grp.m_dispatches++;
+      if (m_timed) {
+        update_now();
+        const auto cost = m_now - start;
+        grp.m_dispatch_ns += cost;
+        grp.m_vtime += std::max<uint64_t>(cost / grp.m_weight, 1);
+      }
+      return res;
+    }
+
+    // `level` is past the last priority level in fair queueing mode
+    void dispatch_one(source &src, size_t level) {
+      const bool is_poll = src.kind() == source::kind::poll;
+      src.m_queued = false;
+      if (is_poll)
+        static_cast<poll_source &>(src).m_ready_iteration = m_iteration;
+      const auto start = m_now;
+      const auto res = run_callback(src);
+      if (m_budgeted && level < num_priorities)
+        m_priority_spent[level] += m_now - start;
+      if (res == source::result::remove)
+        remove(src);
+      else if (is_poll)
+        finish_poll(static_cast<poll_source &>(src));
+    }
+
+    static bool exceeds(uint64_t spent,
+                        std::chrono::nanoseconds budget) noexcept {
+      const auto limit = budget.count();
+      return limit > 0 && spent >= static_cast<uint64_t>(limit);
+    }
+
+    void start_budget() noexcept {
+      m_dispatch_start = m_now;
+      m_priority_spent.fill(0);
+    }
+
+    bool has_ready() const noexcept {
+      return m_ready_mask != 0 || !m_fair_groups.empty();
+    }
+
+    void push_ready(source &src) {
+      if (src.m_queued)
+        return; // left over from the last iteration
+      src.m_queued = true;
+      if (m_options.fair_queueing)
+        return push_fair(src);
+      const auto bucket = ready_bucket(src);
+      m_ready_sources[bucket].push_back({&src, src.m_generation});
+      m_ready_mask |= uint32_t{1} << bucket;
+    }
+
+    uint32_t wait(int64_t timeout) {
+      const auto size = static_cast<uint32_t>(m_events.size());
+      return m_backend->wait(m_events.data(), size, timeout);
+    }
+
+    void collect_events(uint32_t n) {
       for (auto i = 0u; i < n; i++) {
         auto const &e = m_events[i];
-        if (auto found = m_map.find(e.data.fd); found != m_map.end()) {
-          found->second->m_ready_events =
-              static_cast<poll_source::poll_events>(e.events);
+        auto *src = static_cast<poll_source *>(e.data.ptr);
+        if (M_UNLIKELY(!src->m_attached))
+          continue;
+        if (src->is_one_shot())
+          src->m_armed_events = 0; // disabled by the kernel until re-armed
+        const auto events = static_cast<poll_source::poll_events>(e.events);
+        if (src->m_queued) {
+          // held back by a budget and still waiting for its turn
+          src->m_ready_events |= events;
+          continue;
+        }
+        if (src->m_ready_iteration == m_iteration) {
+          // already had its turn in this iteration, carry it over
+          carry(*src);
+          src->m_pending_events |= events;
+          continue;
         }
+        src->m_ready_iteration = m_iteration;
+        src->m_ready_events = events | src->m_pending_events;
+        src->m_pending_events = poll_source::poll_events::none;
+        if (src->check())
+          push_ready(*src);
       }
+    }
 
-      // step 4: check which sources are now ready
-      for (auto &src : m_sources) {
-        if (src->check())
-          m_ready_sources.push_back(src);
+    void collect_carried() {
+      for (auto &c : m_carried_sources) {
+        auto *src = static_cast<poll_source *>(c.src);
+        if (!src)
+          continue; // removed
+        src->m_carried_slot = 0;
+        if (src->m_pending_events == poll_source::poll_events::none)
+          continue; // already picked up from epoll
+        src->m_ready_iteration = m_iteration;
+        src->m_ready_events = src->m_pending_events;
+        src->m_pending_events = poll_source::poll_events::none;
+        push_ready(*src);
       }
+      m_carried_sources.clear();
+    }
 
-      // step 5: dispatch now ready sources
-      if (!m_ready_sources.empty()) {
-        sort_sources(m_ready_sources);
-        for (auto &src : m_ready_sources) {
-          if (src->dispatch() == source::result::remove)
-            remove(*src);
+    // Grows the event buffer when a wait fills it and gives memory back
+    // after a run of mostly empty waits
+    void adapt_events(uint32_t n) {
+      const auto size = m_events.size();
+      if (n == size && size < m_options.max_events) {
+        m_events.resize(std::min(size * 2, m_options.max_events));
+        m_small_batches = 0;
+      } else if (n <= size / 4 && size > m_options.min_events) {
+        if (++m_small_batches >= shrink_after) {
+          m_events.resize(std::max(size / 2, m_options.min_events));
+          m_events.shrink_to_fit();
+          m_small_batches = 0;
         }
-        m_ready_sources.clear();
+      } else {
+        m_small_batches = 0;
       }
     }
+
+    void iterate() {
+      m_iteration++;
+      update_now();
+      const auto dispatched = m_dispatches;
+
+      // step 1: dispatch timers which expired since the last iteration
+      dispatch_timers();
+
+      // step 2: poll file descriptors, waking up for the nearest timer or
+      // idle source and not blocking at all while there are carried over
+      // or held back sources
+      int64_t timeout = 0;
+      if (m_carried_sources.empty() && !has_ready())
+        timeout = min_timeout(timer_timeout(), idle_timeout());
+      flush_interest();
+      auto n = wait(timeout);
+      update_now();
+
+      // step 3: only the reported file descriptors can be ready, quiet
+      // poll sources are never looked at
+      collect_events(n);
+      collect_carried();
+
+      // step 4: dispatch expired timers and ready sources. Sources left
+      // when the budget runs out are ahead of the next iteration's, while
+      // those carried over because they stayed ready queue up behind them,
+      // so they take turns.
+      dispatch_timers();
+      start_budget();
+      bool within_budget = dispatch_ready();
+
+      // step 5: while the buffer keeps filling up, optionally take more
+      // events right away. Each source is dispatched at most once per
+      // iteration, anything reported again is carried to the next one.
+      for (uint32_t batch = 1; within_budget &&
+                               batch < m_options.max_batches &&
+                               n == m_events.size();
+           batch++) {
+        adapt_events(n);
+        flush_interest();
+        n = wait(0);
+        m_stats.drain_batches++;
+        collect_events(n);
+        within_budget = dispatch_ready();
+      }
+      adapt_events(n);
+
+      // step 6: idle sources only get to run when nothing else did
+      if (m_dispatches == dispatched && !has_ready())
+        dispatch_idle();
+
+      m_removed.clear();
+    }
   };
 
+  inline uint64_t idle_source::remaining_ns() const noexcept {
+    const auto now = loop().now();
+    return m_next_run > now ? m_next_run - now : 0;
+  }
+
+  inline uint64_t timeout_source::remaining_ns() const noexcept {
+    const auto now = loop().now();
+    return expires() > now ? expires() - now : 0;
+  }
+
 } // namespace turbine::io
@@ -3,7 +3,7 @@
 #include <turbine/io/source.hpp>
 #include <turbine/linux/epoll.hpp>
 
-#include <functional>
+#include <utility>
 
 namespace turbine::io {
 
@@ -15,32 +15,40 @@ namespace turbine::io {
   public:
     using ptr = pointer_type<poll_source>;
     using poll_events = linux::epoll::events;
-    using callback = std::function<result(poll_events)>;
-    using callback_self = std::function<result(poll_source &, poll_events)>;
-
-  protected:
+    using input_flags = linux::epoll::input_flags;
+    using callback = common::inplace_function<result(poll_events)>;
+    using callback_self =
+        common::inplace_function<result(poll_source &, poll_events)>;
+
+    // `cb` is a callable like callback or callback_self
+    template <class F>
+      requires(is_callback<F, poll_events> ||
+               is_callback<F, poll_source &, poll_events>)
     poll_source(io::loop &loop, posix::fd_ptr f, poll_events watch_events,
-                callback cb, enum source::priority pri = default_priority)
-        : poll_source{loop, std::move(f), watch_events,
-                      [cb = std::move(cb)](auto &, auto e) { return cb(e); },
-                      pri} {
+                F &&cb, enum source::priority pri = default_priority)
+        : poll_source{loop, std::move(f), watch_events, input_flags::none,
+                      std::forward<F>(cb), pri} {
     }
 
+    template <class F>
+      requires(is_callback<F, poll_events> ||
+               is_callback<F, poll_source &, poll_events>)
     poll_source(io::loop &loop, posix::fd_ptr f, poll_events watch_events,
-                callback_self cb, enum source::priority pri = default_priority)
-        : source{loop, pri,
-                 [this, cb = std::move(cb)](auto &) {
-                   if (M_LIKELY(cb))
-                     return cb(*this, this->ready_events());
-                   return result::keep_going;
-                 }}
+                input_flags in_flags, F &&cb,
+                enum source::priority pri = default_priority)
+        : source{loop, pri, wrap(std::forward<F>(cb))}
         , m_fd{std::move(f)}
         , m_watch_events{watch_events}
-        , m_ready_events{poll_events::none} {
+        , m_input_flags{in_flags}
+        , m_ready_events{poll_events::none}
+        , m_pending_events{poll_events::none}
+        , m_armed_events{0}
+        , m_ready_iteration{0}
+        , m_carried_slot{0}
+        , m_dirty_slot{0} {
       assert(m_fd);
     }
 
-  public:
     posix::fd &fd() noexcept {
       assert(m_fd);
       return *m_fd;
@@ -55,10 +63,35 @@ namespace turbine::io {
       return fd().fileno();
     }
 
+    poll_events watch_events() const noexcept {
+      return m_watch_events;
+    }
+
+    input_flags watch_flags() const noexcept {
+      return m_input_flags;
+    }
+
     poll_events ready_events() const noexcept {
       return m_ready_events;
     }
 
+    bool is_edge_triggered() const noexcept {
+      return has_event(m_input_flags, input_flags::edge_triggered);
+    }
+
+    bool is_one_shot() const noexcept {
+      return has_event(m_input_flags, input_flags::one_shot);
+    }
+
+    // An edge-triggered source must keep reading/writing until EAGAIN or it
+    // won't be notified again. A callback which stops early (to be fair to
+    // other sources) calls this so the loop dispatches it again on the next
+    // iteration without waiting for a new edge. One-shot sources are not
+    // re-armed until a dispatch finishes without marking them ready.
+    void mark_ready(poll_events events) noexcept {
+      m_pending_events |= events;
+    }
+
   protected:
     enum kind kind() const noexcept final {
       return kind::poll;
@@ -88,7 +121,27 @@ namespace turbine::io {
   private:
     posix::fd_ptr m_fd;
     poll_events m_watch_events;
-    poll_events m_ready_events; // set by io::loop
+    input_flags m_input_flags;
+    poll_events m_ready_events;   // set by io::loop
+    poll_events m_pending_events; // carried over by io::loop
+    uint32_t m_armed_events;      // as registered with epoll by io::loop
+    uint64_t m_ready_iteration;   // last io::loop iteration it was ready in
+    uint32_t m_carried_slot;      // index + 1 in io::loop's carried list
+    uint32_t m_dirty_slot;        // index + 1 in io::loop's dirty list
+
+    template <class F>
+    static source::callback wrap(F &&cb) {
+      if constexpr (is_callback<F, poll_source &, poll_events>) {
+        return [cb = std::forward<F>(cb)](source &self) mutable -> result {
+          auto &s = static_cast<poll_source &>(self);
+          return cb(s, s.ready_events());
+        };
+      } else {
+        return [cb = std::forward<F>(cb)](source &self) mutable -> result {
+          return cb(static_cast<poll_source &>(self).ready_events());
+        };
+      }
+    }
   };
 
   using poll_source_ptr = poll_source::ptr;
@@ -1,13 +1,15 @@
 #pragma once
 
+#include <turbine/common/inplace_function.hpp>
 #include <turbine/common/utility.hpp>
+#include <turbine/io/source_group.hpp>
 #include <turbine/linux/epoll.hpp>
 #include <turbine/posix/fd.hpp>
 
 #include <cassert>
 #include <cstdint>
-#include <functional>
 #include <memory>
+#include <type_traits>
 
 namespace turbine::io {
 
@@ -25,7 +27,7 @@ namespace turbine::io {
     template <class T>
     using pointer_type = std::shared_ptr<T>;
     using ptr = pointer_type<source>;
-    using callback = std::function<result(source &)>;
+    using callback = common::inplace_function<result(source &)>;
 
     enum class kind : uint8_t {
       timeout,
@@ -48,10 +50,23 @@ namespace turbine::io {
     static constexpr priority default_priority = priority::normal;
 
   protected:
+    // Derived sources take any callable F like this and wrap it straight
+    // into a callback, rather than through their own callback types
+    template <class F, class... Args>
+    static constexpr bool is_callback =
+        std::is_invocable_r_v<result, std::decay_t<F> &, Args...>;
+
     source(io::loop &loop, priority pri, callback cb)
         : m_loop{loop}
         , m_priority{pri}
-        , m_cb{std::move(cb)} {
+        , m_cb{std::move(cb)}
+        , m_attached{false}
+        , m_generation{0}
+        , m_queued{false}
+        , m_group{nullptr}
+        , m_prev{nullptr}
+        , m_next{nullptr}
+        , m_self{} {
       assert(m_cb);
     }
 
@@ -66,6 +81,15 @@ namespace turbine::io {
       return m_loop;
     }
 
+    // nullptr for the loop's default group
+    source_group *group() const noexcept {
+      return m_group;
+    }
+
+    void group(source_group &grp) noexcept {
+      m_group = &grp;
+    }
+
     uint32_t priority_level() const noexcept {
       const uint32_t k = static_cast<uint32_t>(kind()) & 0xFF;
       const uint32_t p = static_cast<uint32_t>(m_priority) & 0xFF;
@@ -95,6 +119,13 @@ namespace turbine::io {
     io::loop &m_loop;
     priority m_priority;
     callback m_cb;
+    bool m_attached;       // set by io::loop
+    uint32_t m_generation; // bumped by io::loop on every add
+    bool m_queued;         // waiting in one of io::loop's ready buckets
+    source_group *m_group;
+    source *m_prev;        // in io::loop's list of its kind
+    source *m_next;
+    ptr m_self; // owns it while attached to io::loop
   };
 
   using source_ptr = source::ptr;
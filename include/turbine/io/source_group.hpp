@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace turbine::io {
+
+  class loop;
+
+  // Sources sharing a weight in io::loop's fair queueing mode, where ready
+  // groups take turns by virtual time and each gets a share of dispatch
+  // time proportional to its weight while they compete. Groups are made by
+  // io::loop::add_group() and live as long as the loop, sources which
+  // weren't given one belong to the loop's default group of weight 1.
+  class source_group {
+    friend class loop;
+
+  public:
+    using ptr = std::shared_ptr<source_group>;
+
+    uint32_t weight() const noexcept {
+      return m_weight;
+    }
+
+    void weight(uint32_t w) noexcept {
+      m_weight = std::max<uint32_t>(w, 1);
+    }
+
+    // Number of callbacks run for sources of the group
+    uint64_t dispatches() const noexcept {
+      return m_dispatches;
+    }
+
+    // Time spent in those callbacks, only measured while the loop is in
+    // fair queueing mode or has a dispatch budget
+    std::chrono::nanoseconds dispatch_time() const noexcept {
+      return std::chrono::nanoseconds{m_dispatch_ns};
+    }
+
+  private:
+    uint32_t m_index; // of the group's ready queue in io::loop
+    uint32_t m_weight;
+    uint64_t m_vtime; // dispatch time so far divided by the weight
+    uint64_t m_dispatches;
+    uint64_t m_dispatch_ns;
+
+    source_group(uint32_t index, uint32_t weight) noexcept
+        : m_index{index}
+        , m_weight{std::max<uint32_t>(weight, 1)}
+        , m_vtime{0}
+        , m_dispatches{0}
+        , m_dispatch_ns{0} {
+    }
+
+    source_group(source_group const &) = delete;
+    source_group &operator=(source_group const &) = delete;
+  };
+
+  using source_group_ptr = source_group::ptr;
+
+} // namespace turbine::io
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <turbine/common/error.hpp>
+#include <turbine/common/macros.hpp>
+#include <turbine/common/utility.hpp>
+#include <turbine/io/backend.hpp>
+#include <turbine/io/poll_source.hpp>
+#include <turbine/io/source.hpp>
+#include <turbine/linux/epoll.hpp>
+#include <turbine/posix/fd.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace turbine::io {
+
+  template <class... Sources>
+  class static_loop;
+
+  namespace detail {
+
+    // Callbacks of static sources optionally take the loop first
+    template <class Loop, class F, class... Args>
+    source::result invoke_static(Loop &lp, F &fnc, Args... args) {
+      if constexpr (std::is_invocable_v<F &, Loop &, Args...>)
+        return fnc(lp, args...);
+      else
+        return fnc(args...);
+    }
+
+  } // namespace detail
+
+  // File descriptor watched by a static_loop, `F` is called like
+  // `result(poll_events)` or `result(Loop &, poll_events)`
+  template <class F>
+  class static_poll {
+    template <class...>
+    friend class static_loop;
+
+  public:
+    using poll_events = poll_source::poll_events;
+    using input_flags = poll_source::input_flags;
+
+    static constexpr const enum source::kind kind = source::kind::poll;
+
+    static_poll(posix::fd_ptr f, poll_events watch_events, F cb)
+        : static_poll{std::move(f), watch_events, input_flags::none,
+                      std::move(cb)} {
+    }
+
+    static_poll(posix::fd_ptr f, poll_events watch_events,
+                input_flags in_flags, F cb)
+        : m_fd{std::move(f)}
+        , m_watch_events{watch_events}
+        , m_input_flags{in_flags}
+        , m_cb{std::move(cb)}
+        , m_active{true} {
+      assert(m_fd);
+    }
+
+    posix::fd &fd() noexcept {
+      return *m_fd;
+    }
+
+    int fileno() const noexcept {
+      return m_fd->fileno();
+    }
+
+    bool is_active() const noexcept {
+      return m_active;
+    }
+
+  private:
+    posix::fd_ptr m_fd;
+    poll_events m_watch_events;
+    input_flags m_input_flags;
+    F m_cb;
+    bool m_active; // cleared once the callback returned result::remove
+  };
+
+  // Periodic timer of a static_loop, scheduled from the previous deadline
+  // like timeout_source. `F` is called like `result()` or `result(Loop &)`.
+  template <class F>
+  class static_timeout {
+    template <class...>
+    friend class static_loop;
+
+  public:
+    static constexpr const enum source::kind kind = source::kind::timeout;
+
+    template <class Rep, class Period>
+    static_timeout(std::chrono::duration<Rep, Period> interval, F cb)
+        : m_interval{static_cast<uint64_t>(std::max<int64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(interval)
+                  .count(),
+              0))}
+        , m_expires{0}
+        , m_overruns{0}
+        , m_cb{std::move(cb)}
+        , m_active{true} {
+    }
+
+    static_timeout(uint64_t timeout_ms, F cb)
+        : static_timeout{std::chrono::milliseconds{timeout_ms},
+                         std::move(cb)} {
+    }
+
+    std::chrono::nanoseconds interval() const noexcept {
+      return std::chrono::nanoseconds{m_interval};
+    }
+
+    // Number of expirations which were missed before the current one,
+    // meaningful while the callback runs
+    uint64_t overruns() const noexcept {
+      return m_overruns;
+    }
+
+    bool is_active() const noexcept {
+      return m_active;
+    }
+
+  private:
+    uint64_t m_interval; // nanoseconds
+    uint64_t m_expires;  // monotonic nanoseconds
+    uint64_t m_overruns;
+    F m_cb;
+    bool m_active;
+  };
+
+  // Called on every iteration of a static_loop, which then doesn't block.
+  // `F` is called like `result()` or `result(Loop &)`.
+  template <class F>
+  class static_idle {
+    template <class...>
+    friend class static_loop;
+
+  public:
+    static constexpr const enum source::kind kind = source::kind::idle;
+
+    explicit static_idle(F cb) : m_cb{std::move(cb)}, m_active{true} {
+    }
+
+    bool is_active() const noexcept {
+      return m_active;
+    }
+
+  private:
+    F m_cb;
+    bool m_active;
+  };
+
+  // Event loop over a set of sources fixed at compile time, for services
+  // whose handlers are all known up front. There are no virtual calls,
+  // shared pointers or ready list: timers and idle sources are walked with
+  // a fold, and each epoll event carries its source's index, which picks
+  // the source's dispatch function from a table built at compile time.
+  // Callbacks are called directly so they can be inlined. A source which
+  // returns result::remove stays inactive for good.
+  //
+  // Unlike io::loop it's single-threaded, quit() must be called from the
+  // loop's thread (usually from a callback).
+  //
+  //   io::static_loop lp{
+  //       io::static_timeout{1s, [](auto &lp) { ... }},
+  //       io::static_poll{fd, poll_events::in, [](auto events) { ... }}};
+  //   return lp.run();
+  template <class... Sources>
+  class static_loop {
+    template <class S>
+    static constexpr bool is_kind(enum source::kind k) noexcept {
+      return std::remove_cvref_t<S>::kind == k;
+    }
+
+    static constexpr const size_t num_polls =
+        (size_t{is_kind<Sources>(source::kind::poll)} + ... + 0);
+
+    using dispatch_func = void (*)(static_loop &, uint32_t events);
+
+  public:
+    explicit static_loop(Sources... sources)
+        : m_running{false}
+        , m_exit_code{0}
+        , m_backend{linux::epoll::flags::close_on_exec}
+        , m_sources{std::move(sources)...}
+        , m_events{}
+        , m_now{time::clock_ns(CLOCK_MONOTONIC)} {
+      add_polls(std::index_sequence_for<Sources...>{});
+    }
+
+    int run() {
+      if (m_running)
+        throw error{"event loop is already running"};
+      m_running = true;
+      m_exit_code = 0;
+      m_now = time::clock_ns(CLOCK_MONOTONIC);
+      for_each([this](auto &s) {
+        if constexpr (is_kind<decltype(s)>(source::kind::timeout))
+          s.m_expires = m_now + s.m_interval;
+      });
+      while (m_running)
+        iterate();
+      return m_exit_code;
+    }
+
+    void quit(int exit_code) noexcept {
+      m_exit_code = exit_code;
+      m_running = false;
+    }
+
+    // Monotonic time in nanoseconds, as of the start of the iteration or
+    // the end of the last wait
+    uint64_t now() const noexcept {
+      return m_now;
+    }
+
+    template <size_t I>
+    auto &get() noexcept {
+      return std::get<I>(m_sources);
+    }
+
+  private:
+    bool m_running;
+    int m_exit_code;
+    epoll_backend m_backend;
+    std::tuple<Sources...> m_sources;
+    std::array<epoll_event, std::max<size_t>(num_polls, 1)> m_events;
+    uint64_t m_now;
+
+    static_loop(static_loop const &) = delete;
+    static_loop &operator=(static_loop const &) = delete;
+
+    template <class Fn>
+    void for_each(Fn &&fnc) {
+      std::apply([&fnc](auto &...s) { (fnc(s), ...); }, m_sources);
+    }
+
+    template <class S>
+    static uint32_t interest(S const &s) noexcept {
+      return static_cast<uint32_t>(s.m_watch_events) |
+             static_cast<uint32_t>(s.m_input_flags);
+    }
+
+    // epoll reports the source's index in place of a pointer
+    static void *tag(size_t index) noexcept {
+      return reinterpret_cast<void *>(index);
+    }
+
+    template <size_t... I>
+    void add_polls(std::index_sequence<I...>) {
+      auto add = [this]<size_t J>(std::integral_constant<size_t, J>) {
+        auto &s = std::get<J>(m_sources);
+        if constexpr (is_kind<decltype(s)>(source::kind::poll))
+          m_backend.add(s.fileno(), interest(s), tag(J));
+      };
+      (add(std::integral_constant<size_t, I>{}), ...);
+    }
+
+    // Nanoseconds until the nearest timer, 0 with an active idle source or
+    // -1 if there is nothing to wake up for
+    int64_t wait_timeout() {
+      int64_t timeout = -1;
+      for_each([this, &timeout](auto &s) {
+        if (!s.m_active)
+          return;
+        if constexpr (is_kind<decltype(s)>(source::kind::idle)) {
+          timeout = 0;
+        } else if constexpr (is_kind<decltype(s)>(source::kind::timeout)) {
+          const auto rem = s.m_expires > m_now ? s.m_expires - m_now : 0;
+          if (timeout < 0 || static_cast<uint64_t>(timeout) > rem)
+            timeout = static_cast<int64_t>(rem);
+        }
+      });
+      return timeout;
+    }
+
+    void dispatch_timers() {
+      for_each([this](auto &s) {
+        if constexpr (is_kind<decltype(s)>(source::kind::timeout)) {
+          if (!s.m_active || s.m_expires > m_now)
+            return;
+          if (s.m_interval == 0) {
+            s.m_overruns = 0;
+            s.m_expires = m_now;
+          } else {
+            s.m_overruns = (m_now - s.m_expires) / s.m_interval;
+            s.m_expires += (s.m_overruns + 1) * s.m_interval;
+          }
+          if (detail::invoke_static(*this, s.m_cb) == source::result::remove)
+            s.m_active = false;
+        }
+      });
+    }
+
+    template <size_t I>
+    static void dispatch_poll(static_loop &lp, uint32_t events) {
+      if constexpr (is_kind<std::tuple_element_t<I, std::tuple<Sources...>>>(
+                        source::kind::poll)) {
+        auto &s = std::get<I>(lp.m_sources);
+        if (!s.m_active)
+          return;
+        const auto ready = static_cast<poll_source::poll_events>(events);
+        if ((ready & s.m_watch_events) != poll_source::poll_events::none &&
+            detail::invoke_static(lp, s.m_cb, ready) ==
+                source::result::remove) {
+          s.m_active = false;
+          lp.m_backend.del(s.fileno());
+        } else if ((s.m_input_flags & poll_source::input_flags::one_shot) !=
+                   poll_source::input_flags::none) {
+          // disabled by the kernel until re-armed, like io::loop does
+          lp.m_backend.mod(s.fileno(), interest(s), tag(I));
+        }
+      }
+    }
+
+    template <size_t... I>
+    static constexpr std::array<dispatch_func, sizeof...(I)>
+    make_dispatch_table(std::index_sequence<I...>) noexcept {
+      return {&dispatch_poll<I>...};
+    }
+
+    static constexpr const std::array<dispatch_func, sizeof...(Sources)>
+        s_dispatch = make_dispatch_table(std::index_sequence_for<Sources...>{});
+
+    void dispatch_idle() {
+      for_each([this](auto &s) {
+        if constexpr (is_kind<decltype(s)>(source::kind::idle)) {
+          if (!s.m_active)
+            return;
+          if (detail::invoke_static(*this, s.m_cb) == source::result::remove)
+            s.m_active = false;
+        }
+      });
+    }
+
+    void iterate() {
+      m_now = time::clock_ns(CLOCK_MONOTONIC);
+      dispatch_timers();
+
+      const auto n = m_backend.wait(
+          m_events.data(), static_cast<uint32_t>(m_events.size()),
+          wait_timeout());
+      m_now = time::clock_ns(CLOCK_MONOTONIC);
+
+      dispatch_timers();
+      for (uint32_t i = 0; i < n; i++) {
+        auto const &e = m_events[i];
+        const auto index = reinterpret_cast<size_t>(e.data.ptr);
+        assert(index < s_dispatch.size());
+        s_dispatch[index](*this, e.events);
+      }
+      dispatch_idle();
+    }
+  };
+
+  template <class... Sources>
+  static_loop(Sources...) -> static_loop<Sources...>;
+
+} // namespace turbine::io
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <turbine/common/macros.hpp>
+
+#include <array>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <utility>
+#include <variant>
+
+namespace turbine::io {
+
+  // Recycles coroutine frames by size class. Each io::loop has one and
+  // makes it current on its thread while running, frames of coroutines
+  // started outside of a running loop come from the heap. Frames have to
+  // be released on the thread of the loop they were allocated from and
+  // before it is destroyed.
+  class frame_pool {
+    struct header {
+      frame_pool *pool;
+      size_t size_class;
+    };
+
+    static constexpr const size_t header_size =
+        (sizeof(header) + alignof(std::max_align_t) - 1) &
+        ~(alignof(std::max_align_t) - 1);
+
+  public:
+    static constexpr const size_t granularity = 64;
+    static constexpr const size_t num_classes = 32; // up to 2 KiB
+
+    // Makes a pool current on this thread for its lifetime
+    class scope {
+    public:
+      scope(frame_pool &pool) noexcept : m_prev{s_current} {
+        s_current = &pool;
+      }
+
+      ~scope() {
+        s_current = m_prev;
+      }
+
+    private:
+      frame_pool *m_prev;
+
+      scope(scope const &) = delete;
+      scope &operator=(scope const &) = delete;
+    };
+
+    frame_pool() noexcept : m_free{} {
+    }
+
+    ~frame_pool() {
+      for (auto *block : m_free) {
+        while (block) {
+          auto *next = *static_cast<void **>(block);
+          ::operator delete(block);
+          block = next;
+        }
+      }
+    }
+
+    static void *allocate(size_t size) {
+      const auto total = size + header_size;
+      const auto cls = (total + granularity - 1) / granularity;
+      auto *pool = s_current;
+      void *block = nullptr;
+      if (pool && cls <= num_classes) {
+        block = pool->take(cls);
+        if (!block)
+          block = ::operator new(cls * granularity);
+      } else {
+        pool = nullptr;
+        block = ::operator new(total);
+      }
+      ::new (block) header{pool, cls};
+      return static_cast<std::byte *>(block) + header_size;
+    }
+
+    static void deallocate(void *ptr) noexcept {
+      auto *block = static_cast<std::byte *>(ptr) - header_size;
+      auto const &h = *reinterpret_cast<header *>(block);
+      if (h.pool)
+        h.pool->give(h.size_class, block);
+      else
+        ::operator delete(block);
+    }
+
+  private:
+    static inline thread_local frame_pool *s_current = nullptr;
+
+    std::array<void *, num_classes + 1> m_free;
+
+    frame_pool(frame_pool const &) = delete;
+    frame_pool &operator=(frame_pool const &) = delete;
+
+    void *take(size_t cls) noexcept {
+      auto *block = m_free[cls];
+      if (block)
+        m_free[cls] = *static_cast<void **>(block);
+      return block;
+    }
+
+    void give(size_t cls, void *block) noexcept {
+      *static_cast<void **>(block) = m_free[cls];
+      m_free[cls] = block;
+    }
+  };
+
+  template <class T>
+  class task;
+
+  namespace detail {
+
+    struct promise_base {
+      std::coroutine_handle<> m_continuation{};
+
+      struct final_awaiter {
+        bool await_ready() const noexcept {
+          return false;
+        }
+
+        template <class P>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<P> h) const noexcept {
+          if (auto cont = h.promise().m_continuation)
+            return cont;
+          return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {
+        }
+      };
+
+      static void *operator new(size_t size) {
+        return frame_pool::allocate(size);
+      }
+
+      static void operator delete(void *ptr) noexcept {
+        frame_pool::deallocate(ptr);
+      }
+
+      std::suspend_always initial_suspend() const noexcept {
+        return {};
+      }
+
+      final_awaiter final_suspend() const noexcept {
+        return {};
+      }
+    };
+
+    template <class T>
+    struct promise final : promise_base {
+      std::variant<std::monostate, T, std::exception_ptr> m_result;
+
+      task<T> get_return_object() noexcept;
+
+      template <class U>
+      void return_value(U &&value) {
+        m_result.template emplace<1>(std::forward<U>(value));
+      }
+
+      void unhandled_exception() noexcept {
+        m_result.template emplace<2>(std::current_exception());
+      }
+
+      T result() {
+        if (m_result.index() == 2)
+          std::rethrow_exception(std::get<2>(m_result));
+        assert(m_result.index() == 1);
+        return std::move(std::get<1>(m_result));
+      }
+    };
+
+    template <>
+    struct promise<void> final : promise_base {
+      std::exception_ptr m_exception;
+
+      task<void> get_return_object() noexcept;
+
+      void return_void() noexcept {
+      }
+
+      void unhandled_exception() noexcept {
+        m_exception = std::current_exception();
+      }
+
+      void result() {
+        if (m_exception)
+          std::rethrow_exception(m_exception);
+      }
+    };
+
+  } // namespace detail
+
+  // Lazily started coroutine producing a T. Awaiting it starts it and
+  // resumes the awaiting coroutine directly once it is done, io::loop::spawn()
+  // runs one without anything awaiting it.
+  template <class T = void>
+  class task {
+  public:
+    using promise_type = detail::promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    task() noexcept : m_handle{} {
+    }
+
+    explicit task(handle_type h) noexcept : m_handle{h} {
+    }
+
+    task(task &&other) noexcept : m_handle{std::exchange(other.m_handle, {})} {
+    }
+
+    task &operator=(task &&other) noexcept {
+      std::swap(m_handle, other.m_handle);
+      return *this;
+    }
+
+    ~task() {
+      if (m_handle)
+        m_handle.destroy();
+    }
+
+    bool is_ready() const noexcept {
+      return !m_handle || m_handle.done();
+    }
+
+    auto operator co_await() && noexcept {
+      struct awaiter {
+        handle_type m_handle;
+
+        bool await_ready() const noexcept {
+          return !m_handle || m_handle.done();
+        }
+
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<> cont) noexcept {
+          m_handle.promise().m_continuation = cont;
+          return m_handle;
+        }
+
+        T await_resume() {
+          assert(m_handle);
+          return m_handle.promise().result();
+        }
+      };
+      return awaiter{m_handle};
+    }
+
+  private:
+    handle_type m_handle;
+
+    task(task const &) = delete;
+    task &operator=(task const &) = delete;
+  };
+
+  namespace detail {
+
+    template <class T>
+    inline task<T> promise<T>::get_return_object() noexcept {
+      return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+    }
+
+    inline task<void> promise<void>::get_return_object() noexcept {
+      return task<void>{
+          std::coroutine_handle<promise<void>>::from_promise(*this)};
+    }
+
+  } // namespace detail
+
+} // namespace turbine::io
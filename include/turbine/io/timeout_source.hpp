@@ -2,49 +2,67 @@
 
 #include <turbine/common/utility.hpp>
 #include <turbine/io/source.hpp>
+#include <turbine/io/timer_wheel.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
-#include <functional>
 #include <memory>
+#include <utility>
 
 namespace turbine::io {
 
   class loop;
 
-  class timeout_source final : public source {
+  // Periodic timer. Each expiration is scheduled from the previous deadline
+  // rather than from when the callback ran, so it doesn't drift, and
+  // expirations missed because the loop was busy are counted in overruns().
+  class timeout_source final : public source, private timer_wheel::node {
     friend class loop;
 
   public:
     using ptr = pointer_type<timeout_source>;
-    using callback = std::function<result()>;
-    using callback_self = std::function<result(timeout_source &)>;
+    using callback = common::inplace_function<result()>;
+    using callback_self = common::inplace_function<result(timeout_source &)>;
+
+    // `cb` is a callable like callback or callback_self
+    template <class Rep, class Period, class F>
+      requires(is_callback<F> || is_callback<F, timeout_source &>)
+    timeout_source(io::loop &loop, std::chrono::duration<Rep, Period> timeout,
+                   F &&cb)
+        : source{loop, priority::lowest, wrap(std::forward<F>(cb))}
+        , timer_wheel::node{}
+        , m_interval{static_cast<uint64_t>(
+              std::max(to_interval(timeout).count(), int64_t{0}))}
+        , m_next_expires{0}
+        , m_overruns{0} {
+    }
+
+    template <class F>
+      requires(is_callback<F> || is_callback<F, timeout_source &>)
+    timeout_source(io::loop &loop, uint64_t timeout_ms, F &&cb)
+        : timeout_source{loop, std::chrono::milliseconds{timeout_ms},
+                         std::forward<F>(cb)} {
+    }
 
-    template <class T>
-    timeout_source(io::loop &loop, std::chrono::duration<T> timeout,
-                   callback cb)
-        : timeout_source{loop, time::to_ms(timeout), std::move(cb)} {
+    std::chrono::nanoseconds interval() const noexcept {
+      return std::chrono::nanoseconds{m_interval};
     }
 
-    timeout_source(io::loop &loop, uint64_t timeout_ms, callback cb)
-        : timeout_source{loop, timeout_ms,
-                         [cb = std::move(cb)](auto &) { return cb(); }} {
+    uint64_t timeout_ms() const noexcept {
+      return m_interval / 1000000;
     }
 
-    template <class T>
-    timeout_source(io::loop &loop, std::chrono::duration<T> timeout,
-                   callback_self cb)
-        : timeout_source{loop, time::to_ms(timeout), std::move(cb)} {
+    // Monotonic time in nanoseconds of the next expiration, or of the
+    // current one while the callback runs
+    uint64_t deadline_ns() const noexcept {
+      return expires();
     }
 
-    timeout_source(io::loop &loop, uint64_t timeout_ms, callback_self cb)
-        : source{loop, priority::lowest,
-                 [this, cb = std::move(cb)](auto &) {
-                   if (M_LIKELY(cb))
-                     return cb(*this);
-                   return result::keep_going;
-                 }}
-        , m_start{turbine::time::now_ms()}
-        , m_timeout{timeout_ms} {
+    // Number of expirations which were missed before the current one,
+    // meaningful while the callback runs
+    uint64_t overruns() const noexcept {
+      return m_overruns;
     }
 
   protected:
@@ -53,37 +71,52 @@ namespace turbine::io {
     }
 
     bool prepare(int64_t &timeout_ms) final {
-      const auto el = elapsed_ms();
-      if (el >= m_timeout) {
-        timeout_ms = 0; // ready now
-        return true;
-      } else {
-        timeout_ms = el; // will be ready in el ms
-        return false;
-      }
+      const auto rem = remaining_ns();
+      timeout_ms = static_cast<int64_t>((rem + 999999) / 1000000);
+      return rem == 0;
     }
 
     bool check() final {
-      return is_elapsed();
-    }
-
-    result dispatch() final {
-      const auto now = turbine::time::now_ms();
-      auto r = source::dispatch();
-      m_start = now;
-      return r;
+      return remaining_ns() == 0;
     }
 
   private:
-    uint64_t m_start;
-    uint64_t m_timeout;
+    uint64_t m_interval; // nanoseconds
+    uint64_t m_next_expires;
+    uint64_t m_overruns;
+
+    template <class Rep, class Period>
+    static std::chrono::nanoseconds
+    to_interval(std::chrono::duration<Rep, Period> timeout) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+    }
 
-    uint64_t elapsed_ms() const {
-      return turbine::time::now_ms() - m_start;
+    template <class F>
+    static source::callback wrap(F &&cb) {
+      if constexpr (is_callback<F, timeout_source &>) {
+        return [cb = std::forward<F>(cb)](source &self) mutable -> result {
+          return cb(static_cast<timeout_source &>(self));
+        };
+      } else {
+        return [cb = std::forward<F>(cb)](source &) mutable -> result {
+          return cb();
+        };
+      }
     }
 
-    bool is_elapsed() const noexcept {
-      return elapsed_ms() >= m_timeout;
+    // the deadline is only meaningful while scheduled on the loop's wheel,
+    // defined in loop.hpp as it needs the loop's cached time
+    uint64_t remaining_ns() const noexcept;
+
+    // Called by the loop when the deadline passed at `now`
+    void expire(uint64_t now) noexcept {
+      if (m_interval == 0) {
+        m_overruns = 0;
+        m_next_expires = now;
+        return;
+      }
+      m_overruns = (now - expires()) / m_interval;
+      m_next_expires = expires() + (m_overruns + 1) * m_interval;
     }
   };
 
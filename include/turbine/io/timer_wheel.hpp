@@ -0,0 +1,274 @@
+#pragma once
+
+#include <turbine/common/macros.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+
+namespace turbine::io {
+
+  // Hierarchical timing wheel. Each level has 64 slots and every level
+  // covers 64 times the range of the one below it, a timer is kept on the
+  // lowest level whose range covers its remaining time and is cascaded down
+  // as the wheel advances. Scheduling and cancelling are O(1) and advancing
+  // only touches the slots that were passed over. Each slot also tracks the
+  // earliest deadline placed on it, so the time to the next deadline is
+  // known without waking up early just to cascade.
+  class timer_wheel {
+  public:
+    class node {
+      friend class timer_wheel;
+
+    public:
+      node() noexcept
+          : m_prev{this}
+          , m_next{this}
+          , m_expires{0}
+          , m_sequence{0}
+          , m_level{0}
+          , m_slot{0} {
+      }
+
+      bool is_scheduled() const noexcept {
+        return m_next != this;
+      }
+
+      uint64_t expires() const noexcept {
+        return m_expires;
+      }
+
+      // Orders timers scheduled to expire at the same time
+      uint64_t sequence() const noexcept {
+        return m_sequence;
+      }
+
+    private:
+      node *m_prev;
+      node *m_next;
+      uint64_t m_expires;
+      uint64_t m_sequence; // of the last schedule()
+      uint8_t m_level;
+      uint8_t m_slot;
+
+      node(node const &) = delete;
+      node &operator=(node const &) = delete;
+
+      bool empty() const noexcept {
+        return m_next == this;
+      }
+
+      void unlink() noexcept {
+        m_prev->m_next = m_next;
+        m_next->m_prev = m_prev;
+        m_prev = this;
+        m_next = this;
+      }
+
+      void push_back(node &n) noexcept {
+        n.m_prev = m_prev;
+        n.m_next = this;
+        m_prev->m_next = &n;
+        m_prev = &n;
+      }
+
+      void splice_back(node &list) noexcept {
+        if (list.empty())
+          return;
+        list.m_next->m_prev = m_prev;
+        list.m_prev->m_next = this;
+        m_prev->m_next = list.m_next;
+        m_prev = list.m_prev;
+        list.m_prev = &list;
+        list.m_next = &list;
+      }
+    };
+
+    static constexpr const unsigned level_bits = 6;
+    static constexpr const unsigned num_slots = 1u << level_bits;
+    static constexpr const unsigned num_levels = 8;
+    static constexpr const uint64_t max_ticks =
+        (uint64_t{1} << (level_bits * num_levels)) - 1;
+
+    timer_wheel(uint64_t now = 0)
+        : m_now{now}
+        , m_sequence{0}
+        , m_occupied{}
+        , m_earliest{}
+        , m_slots{}
+        , m_expired{} {
+    }
+
+    ~timer_wheel() {
+      clear();
+    }
+
+    uint64_t now() const noexcept {
+      return m_now;
+    }
+
+    bool empty() const noexcept {
+      if (!m_expired.empty())
+        return false;
+      return std::all_of(std::begin(m_occupied), std::end(m_occupied),
+                         [](uint64_t bits) { return bits == 0; });
+    }
+
+    void schedule(node &n, uint64_t expires) noexcept {
+      cancel(n);
+      n.m_expires = expires;
+      n.m_sequence = m_sequence++;
+      place(n);
+    }
+
+    bool cancel(node &n) noexcept {
+      if (!n.is_scheduled())
+        return false;
+      n.unlink();
+      if (n.m_level < num_levels) {
+        auto &head = m_slots[n.m_level][n.m_slot];
+        if (head.empty())
+          m_occupied[n.m_level] &= ~(uint64_t{1} << n.m_slot);
+      }
+      return true;
+    }
+
+    // Moves the wheel forward to `now`, any timers which are due by then
+    // can be retrieved with pop_expired(), in no particular order.
+    void advance(uint64_t now) noexcept {
+      if (now <= m_now)
+        return;
+
+      node todo{};
+      uint64_t elapsed = now - m_now;
+
+      for (unsigned level = 0; level < num_levels; ++level) {
+        const unsigned shift = level * level_bits;
+        uint64_t pending = 0;
+
+        if ((elapsed >> shift) >= num_slots) {
+          pending = ~uint64_t{0};
+        } else {
+          const auto count = static_cast<int>((elapsed >> shift) & mask);
+          const auto old_slot = static_cast<int>((m_now >> shift) & mask);
+          const auto new_slot = static_cast<int>((now >> shift) & mask);
+          const uint64_t span = (uint64_t{1} << count) - 1;
+          pending = std::rotl(span, old_slot);
+          pending |= std::rotr(std::rotl(span, new_slot), count);
+          pending |= uint64_t{1} << new_slot;
+        }
+
+        while (auto bits = pending & m_occupied[level]) {
+          const auto slot = std::countr_zero(bits);
+          todo.splice_back(m_slots[level][slot]);
+          m_occupied[level] &= ~(uint64_t{1} << slot);
+        }
+
+        // the next level only moves if this one wrapped around
+        if (!(pending & 1))
+          break;
+        elapsed = std::max(elapsed, uint64_t{num_slots} << shift);
+      }
+
+      m_now = now;
+
+      while (!todo.empty()) {
+        auto &n = *todo.m_next;
+        n.unlink();
+        place(n);
+      }
+    }
+
+    node *pop_expired() noexcept {
+      if (m_expired.empty())
+        return nullptr;
+      auto *n = m_expired.m_next;
+      n->unlink();
+      return n;
+    }
+
+    // Returns the number of ticks until the nearest deadline or -1 if there
+    // are no timers. Cancelled timers may make it early (never later), in
+    // which case it is the time until their slot is cascaded.
+    int64_t next_timeout() const noexcept {
+      if (!m_expired.empty())
+        return 0;
+      int64_t timeout = -1;
+      uint64_t lower_mask = 0;
+      for (unsigned level = 0; level < num_levels; ++level) {
+        if (m_occupied[level]) {
+          const unsigned shift = level * level_bits;
+          const auto slot = static_cast<int>((m_now >> shift) & mask);
+          const auto dist =
+              std::countr_zero(std::rotr(m_occupied[level], slot));
+          uint64_t ticks = static_cast<uint64_t>(dist + (level ? 1 : 0))
+                           << shift;
+          ticks -= m_now & lower_mask;
+          const auto earliest = m_earliest[level][(slot + dist) & mask];
+          if (earliest > m_now)
+            ticks = std::max(ticks, earliest - m_now);
+          if (timeout < 0 || ticks < static_cast<uint64_t>(timeout))
+            timeout = static_cast<int64_t>(ticks);
+        }
+        lower_mask = (lower_mask << level_bits) | mask;
+      }
+      return timeout;
+    }
+
+    void clear() noexcept {
+      auto unlink_all = [](node &head) {
+        while (!head.empty())
+          head.m_next->unlink();
+      };
+      for (auto &level : m_slots) {
+        for (auto &head : level)
+          unlink_all(head);
+      }
+      unlink_all(m_expired);
+      m_occupied.fill(0);
+    }
+
+  private:
+    static constexpr const uint64_t mask = num_slots - 1;
+
+    uint64_t m_now;
+    uint64_t m_sequence;
+    std::array<uint64_t, num_levels> m_occupied;
+    std::array<std::array<uint64_t, num_slots>, num_levels> m_earliest;
+    std::array<std::array<node, num_slots>, num_levels> m_slots;
+    node m_expired;
+
+    timer_wheel(timer_wheel const &) = delete;
+    timer_wheel &operator=(timer_wheel const &) = delete;
+
+    void place(node &n) noexcept {
+      if (n.m_expires <= m_now) {
+        n.m_level = num_levels;
+        m_expired.push_back(n);
+        return;
+      }
+      // timers beyond the wheel's range are placed as if they expired at
+      // its end, and placed again from there
+      const uint64_t expires =
+          m_now + std::min(n.m_expires - m_now, max_ticks);
+      const auto level =
+          static_cast<unsigned>(std::bit_width(expires - m_now) - 1) /
+          level_bits;
+      // timers on the upper levels go one slot early so they are cascaded
+      // before their deadline rather than after it
+      const auto slot = static_cast<unsigned>(
+          ((expires >> (level * level_bits)) - (level ? 1 : 0)) & mask);
+      n.m_level = static_cast<uint8_t>(level);
+      n.m_slot = static_cast<uint8_t>(slot);
+      m_slots[level][slot].push_back(n);
+      const auto bit = uint64_t{1} << slot;
+      auto &earliest = m_earliest[level][slot];
+      if (!(m_occupied[level] & bit) || expires < earliest)
+        earliest = expires;
+      m_occupied[level] |= bit;
+    }
+  };
+
+} // namespace turbine::io
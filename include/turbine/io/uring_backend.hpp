@@ -0,0 +1,200 @@
+#pragma once
+
+#include <turbine/common/error.hpp>
+#include <turbine/common/macros.hpp>
+#include <turbine/io/backend.hpp>
+#include <turbine/linux/io_uring.hpp>
+
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+
+#include <sys/epoll.h>
+
+namespace turbine::io {
+
+  // Poll readiness through io_uring. Edge-triggered interest maps onto a
+  // multishot poll, level-triggered interest onto a single-shot poll which
+  // is re-armed once the event was handed to the loop, and one-shot
+  // interest is left disarmed until mod(). All submissions queued between
+  // two waits go to the kernel with the io_uring_enter() call of the wait.
+  //
+  // Completions carry the file descriptor and a per-descriptor generation
+  // which is bumped by mod() and del(), so completions of cancelled polls
+  // (which may still arrive after the pointer was released) are dropped.
+  class uring_backend final : public backend {
+    struct slot {
+      void *data;
+      uint32_t events;
+      uint32_t generation;
+      bool armed;
+    };
+
+    struct rearm_entry {
+      int fd;
+      uint32_t generation;
+    };
+
+    static constexpr const uint64_t internal_tag = 0;
+    static constexpr const uint32_t input_mask = EPOLLET | EPOLLONESHOT;
+
+  public:
+    static constexpr const uint32_t default_entries = 256;
+
+    uring_backend(uint32_t entries = default_entries)
+        : m_ring{entries, linux::io_uring::setup_flags::clamp}
+        , m_slots{}
+        , m_rearm{} {
+      if (!m_ring.has_features(IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP))
+        throw error{"io_uring backend needs Linux 5.13 or newer"};
+    }
+
+    enum type type() const noexcept final {
+      return type::io_uring;
+    }
+
+    void add(int fd, uint32_t events, void *data) final {
+      auto &s = get_slot(fd, true);
+      if (s.data)
+        throw system_error{EEXIST};
+      s.data = data;
+      s.events = events;
+      s.generation = next_generation(s.generation);
+      arm(fd, s);
+    }
+
+    void mod(int fd, uint32_t events, void *data) final {
+      auto &s = get_slot(fd, false);
+      disarm(fd, s);
+      s.data = data;
+      s.events = events;
+      s.generation = next_generation(s.generation);
+      arm(fd, s);
+    }
+
+    void del(int fd) final {
+      auto &s = get_slot(fd, false);
+      disarm(fd, s);
+      s.data = nullptr;
+      s.generation = next_generation(s.generation);
+    }
+
+    uint32_t wait(epoll_event *events, uint32_t max_events,
+                  int64_t timeout_ns) final {
+      // level-triggered polls which completed in the previous wait are only
+      // re-armed now, after the loop had a chance to consume the data
+      for (auto const &r : m_rearm) {
+        auto &s = m_slots[static_cast<size_t>(r.fd)];
+        if (s.data && !s.armed && s.generation == r.generation)
+          arm(r.fd, s);
+      }
+      m_rearm.clear();
+
+      auto n = reap(events, max_events);
+      if (n > 0 || timeout_ns == 0) {
+        // entering with GETEVENTS also flushes overflowed completions
+        if (m_ring.cq_overflow())
+          m_ring.submit_and_wait(0);
+        else
+          m_ring.submit();
+      } else if (timeout_ns < 0) {
+        m_ring.submit_and_wait(1);
+      } else {
+        __kernel_timespec ts{};
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        m_ring.submit_and_wait(1, ts);
+      }
+      return n + reap(events + n, max_events - n);
+    }
+
+  private:
+    linux::io_uring m_ring;
+    std::vector<slot> m_slots; // indexed by file descriptor
+    std::vector<rearm_entry> m_rearm;
+
+    static uint32_t next_generation(uint32_t gen) noexcept {
+      return ++gen == 0 ? 1 : gen; // never 0, see internal_tag
+    }
+
+    static uint64_t make_tag(int fd, uint32_t gen) noexcept {
+      return (uint64_t{gen} << 32) | static_cast<uint32_t>(fd);
+    }
+
+    slot &get_slot(int fd, bool create) {
+      if (fd < 0)
+        throw system_error{EBADF};
+      const auto idx = static_cast<size_t>(fd);
+      if (idx >= m_slots.size()) {
+        if (!create)
+          throw system_error{ENOENT};
+        m_slots.resize(idx + 1);
+      }
+      auto &s = m_slots[idx];
+      if (!create && !s.data)
+        throw system_error{ENOENT};
+      return s;
+    }
+
+    io_uring_sqe *next_sqe() {
+      if (auto *sqe = m_ring.get_sqe(); M_LIKELY(sqe))
+        return sqe;
+      m_ring.submit(); // make room
+      if (auto *sqe = m_ring.get_sqe(); M_LIKELY(sqe))
+        return sqe;
+      throw system_error{EBUSY};
+    }
+
+    void arm(int fd, slot &s) {
+      uint32_t mask = s.events & ~input_mask;
+      if constexpr (std::endian::native == std::endian::big)
+        mask = std::rotl(mask, 16);
+      auto *sqe = next_sqe();
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = fd;
+      sqe->poll32_events = mask;
+      sqe->len = (s.events & EPOLLET) ? IORING_POLL_ADD_MULTI : 0;
+      sqe->user_data = make_tag(fd, s.generation);
+      s.armed = true;
+    }
+
+    void disarm(int fd, slot &s) {
+      if (!s.armed)
+        return;
+      auto *sqe = next_sqe();
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = make_tag(fd, s.generation);
+      sqe->user_data = internal_tag;
+      s.armed = false;
+    }
+
+    uint32_t reap(epoll_event *events, uint32_t max_events) {
+      return m_ring.reap(max_events, [&](io_uring_cqe const &cqe) {
+        if (cqe.user_data == internal_tag)
+          return false;
+        const auto fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+        const auto gen = static_cast<uint32_t>(cqe.user_data >> 32);
+        if (static_cast<size_t>(fd) >= m_slots.size())
+          return false;
+        auto &s = m_slots[static_cast<size_t>(fd)];
+        if (!s.data || s.generation != gen)
+          return false; // removed or modified since it was armed
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          s.armed = false;
+          if (!(s.events & EPOLLONESHOT))
+            m_rearm.push_back({fd, gen});
+        }
+        if (cqe.res == -ECANCELED)
+          return false;
+        auto &e = events[0];
+        events++;
+        e.events = cqe.res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe.res);
+        e.data.ptr = s.data;
+        return true;
+      });
+    }
+  };
+
+} // namespace turbine::io
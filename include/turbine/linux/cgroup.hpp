@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#undef linux
+
+namespace turbine::linux {
+
+  namespace cgroup {
+
+    namespace detail {
+
+      // Quota divided by period, or nothing for "max" or a missing file
+      inline std::optional<double> read_cpu_max(std::string const &path) {
+        std::ifstream f{path};
+        std::string quota;
+        uint64_t period = 0;
+        if (!(f >> quota >> period) || quota == "max" || period == 0)
+          return std::nullopt;
+        return std::stod(quota) / static_cast<double>(period);
+      }
+
+      inline std::optional<double> read_cfs(std::string const &dir) {
+        std::ifstream fq{dir + "/cpu.cfs_quota_us"};
+        std::ifstream fp{dir + "/cpu.cfs_period_us"};
+        int64_t quota = -1;
+        int64_t period = 0;
+        if (!(fq >> quota) || !(fp >> period) || quota <= 0 || period <= 0)
+          return std::nullopt;
+        return static_cast<double>(quota) / static_cast<double>(period);
+      }
+
+    } // namespace detail
+
+    // Number of CPUs worth of time this process may use per scheduling
+    // period under its cgroup's CPU bandwidth limit, the tightest one
+    // along the hierarchy with cgroup v2 ("cpu.max") or the limit of the
+    // cpu controller's cgroup with v1 ("cpu.cfs_quota_us"). Nothing if
+    // there is no limit.
+    inline std::optional<double> cpu_limit() {
+      std::ifstream self{"/proc/self/cgroup"};
+      std::string line;
+      std::optional<double> limit;
+      auto tighten = [&limit](std::optional<double> l) {
+        if (l && (!limit || *l < *limit))
+          limit = l;
+      };
+      while (std::getline(self, line)) {
+        // "hierarchy-id:controllers:path"
+        const auto first = line.find(':');
+        const auto second = line.find(':', first + 1);
+        if (first == line.npos || second == line.npos)
+          continue;
+        const auto controllers = line.substr(first + 1, second - first - 1);
+        auto path = line.substr(second + 1);
+        if (path == "/")
+          path.clear();
+        if (controllers.empty()) {
+          for (;;) {
+            tighten(detail::read_cpu_max("/sys/fs/cgroup" + path +
+                                         "/cpu.max"));
+            const auto slash = path.rfind('/');
+            if (slash == path.npos)
+              break;
+            path.erase(slash);
+          }
+        } else if (("," + controllers + ",").find(",cpu,") !=
+                   std::string::npos) {
+          // in a container the path is often that of the host, with the
+          // container's own cgroup mounted at the root
+          tighten(detail::read_cfs("/sys/fs/cgroup/cpu" + path));
+          tighten(detail::read_cfs("/sys/fs/cgroup/cpu"));
+        }
+      }
+      return limit;
+    }
+
+  } // namespace cgroup
+
+} // namespace turbine::linux
@@ -2,6 +2,7 @@
 
 #include <turbine/common/error.hpp>
 #include <turbine/common/flags.hpp>
+#include <turbine/common/macros.hpp>
 #include <turbine/posix/fd.hpp>
 
 #include <cassert>
@@ -10,7 +11,10 @@
 #include <cstring>
 #include <limits>
 
+#include <linux/time_types.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #undef linux
 
@@ -114,6 +118,28 @@ namespace turbine::linux {
       throw system_error{};
     }
 
+    // Waits with a nanosecond timeout using epoll_pwait2(), Linux 5.11+.
+    // Throws system_error with ENOSYS if the kernel doesn't have it.
+    template <class T>
+    uint32_t pwait2(T &events, int64_t timeout_ns = -1) {
+#ifdef SYS_epoll_pwait2
+      __kernel_timespec ts{};
+      ts.tv_sec = timeout_ns / 1000000000;
+      ts.tv_nsec = timeout_ns % 1000000000;
+      if (auto n = ::syscall(SYS_epoll_pwait2, fileno(), events.data(),
+                             static_cast<int>(events.size()),
+                             timeout_ns < 0 ? nullptr : &ts, nullptr, 0);
+          n >= 0) {
+        return static_cast<uint32_t>(n);
+      }
+      throw system_error{};
+#else
+      M_UNUSED(events);
+      M_UNUSED(timeout_ns);
+      throw system_error{ENOSYS};
+#endif
+    }
+
     template <class T, class U>
     uint32_t wait(T &events, std::chrono::duration<U> timeout) {
       const auto timeout_ms =
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <turbine/common/error.hpp>
+#include <turbine/common/flags.hpp>
+#include <turbine/common/macros.hpp>
+#include <turbine/posix/fd.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#undef linux
+
+namespace turbine::linux {
+
+  // Minimal io_uring wrapper using the raw system calls, no liburing
+  class io_uring : public posix::fd {
+  public:
+    enum class setup_flags : uint32_t {
+      none = 0,
+      clamp = IORING_SETUP_CLAMP,
+      submit_all = IORING_SETUP_SUBMIT_ALL,
+    };
+
+    enum class enter_flags : uint32_t {
+      none = 0,
+      get_events = IORING_ENTER_GETEVENTS,
+      ext_arg = IORING_ENTER_EXT_ARG,
+    };
+
+    io_uring(uint32_t entries, setup_flags fl = setup_flags::none)
+        : posix::fd{-1}
+        , m_params{}
+        , m_sq_ring{nullptr}
+        , m_sq_ring_size{0}
+        , m_cq_ring{nullptr}
+        , m_cq_ring_size{0}
+        , m_sqes{nullptr}
+        , m_sq{}
+        , m_cq{}
+        , m_sq_tail{0}
+        , m_sq_submitted{0} {
+      m_params.flags = static_cast<uint32_t>(fl);
+      auto f = ::syscall(__NR_io_uring_setup, entries, &m_params);
+      if (f < 0)
+        throw system_error{};
+      fileno(static_cast<int>(f));
+      map_rings();
+    }
+
+    ~io_uring() override {
+      unmap_rings();
+    }
+
+    uint32_t features() const noexcept {
+      return m_params.features;
+    }
+
+    bool has_features(uint32_t feats) const noexcept {
+      return (m_params.features & feats) == feats;
+    }
+
+    uint32_t sq_entries() const noexcept {
+      return m_params.sq_entries;
+    }
+
+    // True if completions did not fit the completion queue and are held
+    // back by the kernel until the next io_uring_enter() with GETEVENTS
+    bool cq_overflow() const noexcept {
+      return load_relaxed(m_sq.flags) & IORING_SQ_CQ_OVERFLOW;
+    }
+
+    // Number of queued entries not yet handed to the kernel
+    uint32_t pending() const noexcept {
+      return m_sq_tail - m_sq_submitted;
+    }
+
+    // Returns a zeroed submission entry or nullptr if the queue is full
+    io_uring_sqe *get_sqe() noexcept {
+      const auto head = load_acquire(m_sq.head);
+      if (m_sq_tail - head >= *m_sq.entries)
+        return nullptr;
+      const auto idx = m_sq_tail & *m_sq.mask;
+      auto *sqe = &m_sqes[idx];
+      std::memset(sqe, 0, sizeof *sqe);
+      m_sq.array[idx] = idx;
+      m_sq_tail++;
+      return sqe;
+    }
+
+    // Submits the queued entries and optionally waits for completions,
+    // returns false if the wait timed out or was interrupted
+    bool enter(uint32_t min_complete = 0,
+               enter_flags fl = enter_flags::none, void const *arg = nullptr,
+               size_t arg_size = 0) {
+      store_release(m_sq.tail, m_sq_tail);
+      const auto to_submit = pending();
+      auto r = ::syscall(__NR_io_uring_enter, fileno(), to_submit,
+                         min_complete, static_cast<uint32_t>(fl), arg,
+                         arg_size);
+      if (r >= 0) {
+        m_sq_submitted += static_cast<uint32_t>(r);
+        return true;
+      }
+      if (errno == ETIME || errno == EINTR || errno == EBUSY)
+        return false;
+      throw system_error{};
+    }
+
+    bool submit() {
+      if (pending() == 0)
+        return true;
+      return enter();
+    }
+
+    bool submit_and_wait(uint32_t min_complete = 1) {
+      return enter(min_complete, enter_flags::get_events);
+    }
+
+    bool submit_and_wait(uint32_t min_complete, __kernel_timespec const &ts) {
+      io_uring_getevents_arg arg{};
+      arg.sigmask_sz = _NSIG / 8;
+      arg.ts = reinterpret_cast<uint64_t>(&ts);
+      constexpr auto fl = static_cast<enter_flags>(IORING_ENTER_GETEVENTS |
+                                                   IORING_ENTER_EXT_ARG);
+      return enter(min_complete, fl, &arg, sizeof arg);
+    }
+
+    // Calls `fn` on completions until there are none left or it has
+    // returned true `max` times, returns that count
+    template <class F>
+    uint32_t reap(uint32_t max, F &&fn) {
+      auto head = load_relaxed(m_cq.head);
+      const auto tail = load_acquire(m_cq.tail);
+      uint32_t n = 0;
+      while (head != tail && n < max) {
+        if (fn(m_cq.cqes[head & *m_cq.mask]))
+          n++;
+        head++;
+      }
+      store_release(m_cq.head, head);
+      return n;
+    }
+
+  private:
+    struct sq_ring {
+      uint32_t *head;
+      uint32_t *tail;
+      uint32_t *mask;
+      uint32_t *entries;
+      uint32_t *flags;
+      uint32_t *array;
+    };
+
+    struct cq_ring {
+      uint32_t *head;
+      uint32_t *tail;
+      uint32_t *mask;
+      io_uring_cqe *cqes;
+    };
+
+    io_uring_params m_params;
+    void *m_sq_ring;
+    size_t m_sq_ring_size;
+    void *m_cq_ring;
+    size_t m_cq_ring_size;
+    io_uring_sqe *m_sqes;
+    sq_ring m_sq;
+    cq_ring m_cq;
+    uint32_t m_sq_tail;
+    uint32_t m_sq_submitted;
+
+    io_uring(io_uring const &) = delete;
+    io_uring &operator=(io_uring const &) = delete;
+
+    static uint32_t load_relaxed(uint32_t *p) noexcept {
+      return std::atomic_ref<uint32_t>{*p}.load(std::memory_order_relaxed);
+    }
+
+    static uint32_t load_acquire(uint32_t *p) noexcept {
+      return std::atomic_ref<uint32_t>{*p}.load(std::memory_order_acquire);
+    }
+
+    static void store_release(uint32_t *p, uint32_t v) noexcept {
+      std::atomic_ref<uint32_t>{*p}.store(v, std::memory_order_release);
+    }
+
+    static void *map(size_t size, off_t offset, int fd) {
+      auto *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, offset);
+      if (p == MAP_FAILED)
+        throw system_error{};
+      return p;
+    }
+
+    template <class T>
+    static T *at(void *base, uint32_t offset) noexcept {
+      return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    void map_rings() {
+      auto const &p = m_params;
+      m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+      m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+      if (single) {
+        m_sq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        m_cq_ring_size = 0;
+      }
+      try {
+        m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING, fileno());
+        m_cq_ring = single ? m_sq_ring
+                           : map(m_cq_ring_size, IORING_OFF_CQ_RING, fileno());
+        m_sqes = static_cast<io_uring_sqe *>(
+            map(p.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES,
+                fileno()));
+      } catch (...) {
+        unmap_rings();
+        throw;
+      }
+      m_sq.head = at<uint32_t>(m_sq_ring, p.sq_off.head);
+      m_sq.tail = at<uint32_t>(m_sq_ring, p.sq_off.tail);
+      m_sq.mask = at<uint32_t>(m_sq_ring, p.sq_off.ring_mask);
+      m_sq.entries = at<uint32_t>(m_sq_ring, p.sq_off.ring_entries);
+      m_sq.flags = at<uint32_t>(m_sq_ring, p.sq_off.flags);
+      m_sq.array = at<uint32_t>(m_sq_ring, p.sq_off.array);
+      m_cq.head = at<uint32_t>(m_cq_ring, p.cq_off.head);
+      m_cq.tail = at<uint32_t>(m_cq_ring, p.cq_off.tail);
+      m_cq.mask = at<uint32_t>(m_cq_ring, p.cq_off.ring_mask);
+      m_cq.cqes = at<io_uring_cqe>(m_cq_ring, p.cq_off.cqes);
+      m_sq_tail = load_relaxed(m_sq.tail);
+      m_sq_submitted = m_sq_tail;
+    }
+
+    void unmap_rings() noexcept {
+      if (m_sqes)
+        ::munmap(m_sqes, m_params.sq_entries * sizeof(io_uring_sqe));
+      if (m_cq_ring && m_cq_ring != m_sq_ring)
+        ::munmap(m_cq_ring, m_cq_ring_size);
+      if (m_sq_ring)
+        ::munmap(m_sq_ring, m_sq_ring_size);
+      m_sqes = nullptr;
+      m_cq_ring = nullptr;
+      m_sq_ring = nullptr;
+    }
+  };
+
+} // namespace turbine::linux
+
+M_ENABLE_ENUM_FLAGS(turbine::linux::io_uring::setup_flags);
+M_ENABLE_ENUM_FLAGS(turbine::linux::io_uring::enter_flags);
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <turbine/linux/cgroup.hpp>
 #include <turbine/linux/epoll.hpp>
 #include <turbine/linux/eventfd.hpp>
 #include <turbine/linux/inotify.hpp>
+#include <turbine/linux/io_uring.hpp>
+#include <turbine/linux/numa.hpp>
 #include <turbine/linux/signalfd.hpp>
 #include <turbine/linux/timerfd.hpp>
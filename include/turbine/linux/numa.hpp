@@ -0,0 +1,116 @@
+#pragma once
+
+#include <turbine/common/error.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#undef linux
+
+namespace turbine::linux {
+
+  namespace numa {
+
+    // CPUs of a NUMA node which this process may run on
+    struct node {
+      uint32_t id;
+      std::vector<uint32_t> cpus;
+    };
+
+    // Parses a kernel CPU list like "0-3,8,10-11"
+    inline std::vector<uint32_t> parse_cpu_list(std::string_view list) {
+      std::vector<uint32_t> cpus;
+      while (!list.empty()) {
+        const auto comma = list.find(',');
+        auto range = list.substr(0, comma);
+        list = comma == list.npos ? std::string_view{}
+                                  : list.substr(comma + 1);
+        while (!range.empty() &&
+               std::isspace(static_cast<unsigned char>(range.back())))
+          range.remove_suffix(1);
+        if (range.empty())
+          continue;
+        const auto dash = range.find('-');
+        const std::string first{range.substr(0, dash)};
+        const auto lo =
+            static_cast<uint32_t>(std::strtoul(first.c_str(), nullptr, 10));
+        auto hi = lo;
+        if (dash != range.npos) {
+          const std::string last{range.substr(dash + 1)};
+          hi = static_cast<uint32_t>(std::strtoul(last.c_str(), nullptr, 10));
+        }
+        for (auto cpu = lo; cpu <= hi; cpu++)
+          cpus.push_back(cpu);
+      }
+      return cpus;
+    }
+
+    // CPUs in this thread's affinity mask, e.g. as limited by taskset or a
+    // cpuset cgroup
+    inline std::vector<uint32_t> allowed_cpus() {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      if (::sched_getaffinity(0, sizeof set, &set) != 0)
+        throw system_error{};
+      std::vector<uint32_t> cpus;
+      for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set))
+          cpus.push_back(cpu);
+      }
+      return cpus;
+    }
+
+    // NUMA nodes with at least one allowed CPU, from
+    // /sys/devices/system/node. Without NUMA support all allowed CPUs are
+    // reported as node 0.
+    inline std::vector<node> nodes() {
+      const auto allowed = allowed_cpus();
+      std::vector<node> result;
+      std::ifstream online{"/sys/devices/system/node/online"};
+      std::string list;
+      if (online && std::getline(online, list)) {
+        for (auto id : parse_cpu_list(list)) {
+          std::ifstream f{"/sys/devices/system/node/node" +
+                          std::to_string(id) + "/cpulist"};
+          std::string cpu_list;
+          if (!f || !std::getline(f, cpu_list))
+            continue;
+          node n{id, {}};
+          for (auto cpu : parse_cpu_list(cpu_list)) {
+            if (std::ranges::binary_search(allowed, cpu))
+              n.cpus.push_back(cpu);
+          }
+          if (!n.cpus.empty())
+            result.push_back(std::move(n));
+        }
+      }
+      if (result.empty())
+        result.push_back(node{0, allowed});
+      return result;
+    }
+
+    // Restricts a thread to the given CPUs
+    inline void pin_thread(pthread_t thread,
+                           std::vector<uint32_t> const &cpus) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (auto cpu : cpus) {
+        if (cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &set);
+      }
+      if (const int rc = ::pthread_setaffinity_np(thread, sizeof set, &set))
+        throw system_error{rc};
+    }
+
+  } // namespace numa
+
+} // namespace turbine::linux
@@ -61,6 +61,14 @@ namespace turbine::linux {
         throw system_error{};
     }
 
+    // Arms the timer to expire once, `value` from now
+    void set(std::chrono::nanoseconds value) {
+      std::memset(&m_its, 0, sizeof(itimerspec));
+      m_its.it_value = ns_to_ts(value);
+      if (::timerfd_settime(fileno(), 0, &m_its, nullptr) != 0)
+        throw system_error{};
+    }
+
     template <class T>
     void get(std::chrono::duration<T> &value,
              std::chrono::duration<T> &interval) {
@@ -41,7 +41,7 @@ namespace turbine::net::tcp {
     }
 
     template <class T, class... Args>
-    auto make(Args &&...args) {
+    static auto make(Args &&...args) {
       static_assert(std::is_base_of_v<tcp::socket, T>);
       return std::shared_ptr<T>(new T{std::forward<Args>(args)...});
     }
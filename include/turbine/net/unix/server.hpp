@@ -11,11 +11,11 @@ namespace turbine::net::unix {
     using ptr = std::shared_ptr<server>;
 
     auto bind() {
+      ::unlink(path().data()); // left over by a previous server
       return net::socket::bind();
     }
 
     auto listen(int backlog = default_backlog) {
-      ::unlink(path().data());
       return net::socket::listen(backlog);
     }
 
@@ -34,7 +34,7 @@ namespace turbine::net::unix {
     }
 
     template <class T, class... Args>
-    auto make(Args &&...args) {
+    static auto make(Args &&...args) {
       static_assert(std::is_base_of_v<unix::socket, T>);
       return std::shared_ptr<T>(new T{std::forward<Args>(args)...});
     }
@@ -0,0 +1,224 @@
+// io::async_socket over a Unix socket connection: reads and writes which
+// only partially complete suspend on EAGAIN and resume once the socket is
+// ready again, sockets may be destroyed by the coroutines they resume and
+// coroutines suspended on a socket may be destroyed
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+
+namespace {
+
+  const std::string socket_path =
+      "/tmp/turbine-async-socket-" + std::to_string(::getpid());
+
+  // Sets a flag when destroyed, to tell whether a coroutine frame was
+  struct destroyed_flag {
+    bool &flag;
+
+    ~destroyed_flag() {
+      flag = true;
+    }
+  };
+
+  struct connection {
+    net::unix::server_ptr server;
+    net::unix::client_ptr client;
+    net::socket_ptr accepted;
+  };
+
+  connection connect() {
+    connection c;
+    c.server = net::unix::server::make(socket_path, true);
+    c.client = net::unix::client::make(socket_path, true);
+    c.accepted = c.server->accept();
+    return c;
+  }
+
+  std::vector<char> make_payload(size_t size) {
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; i++)
+      data[i] = static_cast<char>(i * 7 % 251);
+    return data;
+  }
+
+  void timeout_after(io::loop &lp, std::chrono::milliseconds timeout) {
+    lp.add_timeout(timeout, [&lp] {
+      lp.quit(-1);
+      return result::remove;
+    });
+  }
+
+  // Owns its socket, which is destroyed from the socket's own dispatch
+  // once the peer shuts down its side
+  io::task<void> echo(io::async_socket_ptr sock) {
+    std::array<char, 4096> buf;
+    for (;;) {
+      const auto n = co_await sock->read(buf);
+      if (n == 0)
+        break;
+      co_await sock->write(buf.data(), n);
+    }
+  }
+
+  io::task<void> send_all(io::loop &lp, io::async_socket &sock,
+                          std::vector<char> const &data, bool &suspended) {
+    const auto before = lp.iteration();
+    CHECK(co_await sock.write(data) == data.size());
+    suspended = lp.iteration() > before;
+    ::shutdown(sock.socket().fileno(), SHUT_WR);
+  }
+
+  io::task<void> receive_all(io::loop &lp, io::async_socket &sock,
+                             std::vector<char> &out, size_t &reads) {
+    std::array<char, 1000> buf;
+    for (;;) {
+      const auto n = co_await sock.read(buf);
+      if (n == 0)
+        break;
+      reads++;
+      out.insert(out.end(), buf.data(), buf.data() + n);
+    }
+    lp.quit(0);
+  }
+
+  // A payload much bigger than the socket buffers makes the client's
+  // write suspend while both sides read it in small pieces
+  void test_echo() {
+    const auto data = make_payload(4 * 1024 * 1024 + 123);
+    auto c = connect();
+    io::loop lp;
+    io::async_socket client{lp, c.client};
+    std::vector<char> received;
+    size_t reads = 0;
+    bool suspended = false;
+    lp.setup_func([&] {
+      lp.spawn(echo(std::make_shared<io::async_socket>(lp, c.accepted)));
+      c.accepted.reset();
+      lp.spawn(receive_all(lp, client, received, reads));
+      lp.spawn(send_all(lp, client, data, suspended));
+    });
+    timeout_after(lp, 10s);
+    CHECK(lp.run() == 0);
+    CHECK(suspended);
+    CHECK(received == data);
+    CHECK(reads > data.size() / 1000);
+  }
+
+  io::task<void> accept_one(io::loop &lp, io::async_socket &listener,
+                            uint64_t &suspended_for) {
+    const auto before = lp.iteration();
+    auto sock = co_await listener.accept<net::unix::socket>();
+    suspended_for = lp.iteration() - before;
+    io::async_socket conn{lp, sock};
+    const std::string greeting = "hello";
+    CHECK(co_await conn.write(greeting) == greeting.size());
+  }
+
+  io::task<void> connect_later(io::loop &lp, std::string &greeting) {
+    co_await lp.sleep(5ms);
+    io::async_socket sock{lp, net::unix::client::make(socket_path, true)};
+    std::array<char, 16> buf;
+    const auto n = co_await sock.read(buf);
+    greeting.assign(buf.data(), n);
+    lp.quit(0);
+  }
+
+  // accept() waits for a connection without blocking the loop
+  void test_accept() {
+    auto server = net::unix::server::make(socket_path, true);
+    io::loop lp;
+    io::async_socket listener{lp, server};
+    uint64_t suspended_for = 0;
+    std::string greeting;
+    lp.setup_func([&] {
+      lp.spawn(accept_one(lp, listener, suspended_for));
+      lp.spawn(connect_later(lp, greeting));
+    });
+    timeout_after(lp, 2s);
+    CHECK(lp.run() == 0);
+    CHECK(suspended_for > 0);
+    CHECK(greeting == "hello");
+  }
+
+  io::task<void> read_forever(io::async_socket_ptr sock, bool &resumed,
+                              bool &destroyed) {
+    destroyed_flag guard{destroyed};
+    std::array<char, 16> buf;
+    co_await sock->read(buf);
+    resumed = true;
+  }
+
+  // A coroutine suspended on a read is destroyed with the loop, taking its
+  // operation out of the socket before the socket goes
+  void test_destroy_suspended() {
+    auto c = connect();
+    bool resumed = false;
+    bool destroyed = false;
+    {
+      io::loop lp;
+      lp.setup_func([&] {
+        lp.spawn(read_forever(
+            std::make_shared<io::async_socket>(lp, c.accepted), resumed,
+            destroyed));
+        lp.add_timeout(5ms, [&lp] {
+          lp.quit(0);
+          return result::remove;
+        });
+      });
+      CHECK(lp.run() == 0);
+      c.client->send('x');
+      CHECK(!destroyed);
+    }
+    CHECK(destroyed);
+    CHECK(!resumed);
+  }
+
+  io::task<void> write_to_closed(io::loop &lp, io::async_socket &sock,
+                                 int &error) {
+    const auto data = make_payload(1024);
+    try {
+      co_await sock.write(data);
+    } catch (system_error const &e) {
+      error = e.code();
+    }
+    lp.quit(0);
+  }
+
+  // Failures are thrown from the awaiting coroutine
+  void test_errors() {
+    auto c = connect();
+    c.client.reset();
+    io::loop lp;
+    io::async_socket sock{lp, c.accepted};
+    int error = 0;
+    lp.setup_func([&] { lp.spawn(write_to_closed(lp, sock, error)); });
+    timeout_after(lp, 2s);
+    CHECK(lp.run() == 0);
+    CHECK(error == EPIPE);
+  }
+
+} // namespace
+
+int main() {
+  test_echo();
+  test_accept();
+  test_destroy_suspended();
+  test_errors();
+  ::unlink(socket_path.c_str());
+  return 0;
+}
@@ -0,0 +1,239 @@
+// Runs the same io::loop checks on every readiness backend
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+using poll_events = io::poll_source::poll_events;
+using input_flags = io::poll_source::input_flags;
+
+namespace {
+
+  io::loop::options backend_options(enum io::backend::type type) {
+    io::loop::options opts;
+    opts.backend_type = type;
+    return opts;
+  }
+
+  posix::pipe::pair make_pipe() {
+    return posix::pipe::make(posix::pipe::flags::non_blocking |
+                             posix::pipe::flags::close_on_exec);
+  }
+
+  bool has_in(poll_events events) {
+    return (events & poll_events::in) != poll_events::none;
+  }
+
+  // Fails the test instead of hanging if the loop never quits
+  void add_watchdog(io::loop &lp) {
+    lp.add_timeout(2s, [&lp] {
+      lp.quit(-1);
+      return result::remove;
+    });
+  }
+
+  // Timers fire in deadline order and never before their deadline
+  void test_timers(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    const auto start = lp.now();
+    std::vector<int> order;
+    int periodic = 0;
+    lp.add_timeout(5ms, [&](io::timeout_source &self) {
+      CHECK(lp.now() >= self.deadline_ns());
+      CHECK(lp.now() - start >= 5000000);
+      order.push_back(2);
+      return result::remove;
+    });
+    lp.add_timeout(1ms, [&order] {
+      order.push_back(1);
+      return result::remove;
+    });
+    lp.add_timeout(500us, [&](io::timeout_source &self) {
+      CHECK(lp.now() >= self.deadline_ns());
+      return ++periodic == 10 ? result::remove : result::keep_going;
+    });
+    lp.add_timeout(30ms, [&lp] {
+      lp.quit(3);
+      return result::remove;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 3);
+    CHECK((order == std::vector<int>{1, 2}));
+    CHECK(periodic == 10);
+  }
+
+  // Timers which expired while the loop was stalled still fire by
+  // deadline, and those with the same deadline in the order they were set
+  void test_stalled_timers(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    std::vector<int> order;
+    auto add = [&](std::chrono::microseconds timeout, int id) {
+      lp.add_timeout(timeout, [&order, id] {
+        order.push_back(id);
+        return result::remove;
+      });
+    };
+    add(3000us, 6);
+    add(200us, 1);
+    add(1100us, 3); // shares a slot of the wheel with the next one
+    add(1000us, 2);
+    add(2000us, 4);
+    add(2000us, 5);
+    add(70ms, 7); // on an upper level of the wheel, cascaded
+    lp.setup_func([] { std::this_thread::sleep_for(80ms); });
+    lp.add_timeout(90ms, [&lp] {
+      lp.quit(0);
+      return result::remove;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    CHECK((order == std::vector<int>{1, 2, 3, 4, 5, 6, 7}));
+  }
+
+  // Unread data is reported on every iteration
+  void test_level_triggered(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    auto p = make_pipe();
+    p.write_end->write('x');
+    int calls = 0;
+    lp.add_poll(p.read_end, poll_events::in, [&](poll_events events) {
+      CHECK(has_in(events));
+      if (++calls == 3)
+        lp.quit(0);
+      return result::keep_going;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    CHECK(calls == 3);
+  }
+
+  // Unread data is reported once, until more is written
+  void test_edge_triggered(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    auto p = make_pipe();
+    p.write_end->write('x');
+    int calls = 0;
+    lp.add_poll(p.read_end, poll_events::in, input_flags::edge_triggered,
+                [&](poll_events events) {
+                  CHECK(has_in(events));
+                  if (++calls == 2)
+                    lp.quit(0);
+                  return result::keep_going;
+                });
+    lp.add_timeout(20ms, [&] {
+      CHECK(calls == 1);
+      p.write_end->write('y');
+      return result::remove;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    CHECK(calls == 2);
+  }
+
+  // Disabled after each event until the loop re-arms it, which it does
+  // once the callback returns
+  void test_one_shot(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    auto p = make_pipe();
+    p.write_end->write('x');
+    int calls = 0;
+    lp.add_poll(p.read_end, poll_events::in, input_flags::one_shot,
+                [&](poll_events events) {
+                  CHECK(has_in(events));
+                  char c = 0;
+                  p.read_end->read(c);
+                  if (++calls == 3)
+                    lp.quit(0);
+                  return result::keep_going;
+                });
+    lp.add_timeout(5ms, [&] {
+      p.write_end->write('y');
+      return calls < 3 ? result::keep_going : result::remove;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    CHECK(calls == 3);
+    CHECK(lp.stats().interest_updates >= 3);
+  }
+
+  // Tasks posted from another thread all run, in order, on the loop's
+  // thread
+  void test_post(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    const auto loop_thread = std::this_thread::get_id();
+    std::vector<int> ran;
+    std::thread poster;
+    lp.setup_func([&] {
+      poster = std::thread{[&] {
+        for (int i = 0; i < 100; i++) {
+          lp.post([&, i] {
+            CHECK(std::this_thread::get_id() == loop_thread);
+            ran.push_back(i);
+          });
+        }
+        lp.post([&lp] { lp.quit(4); });
+      }};
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 4);
+    poster.join();
+    CHECK(ran.size() == 100);
+    for (int i = 0; i < 100; i++)
+      CHECK(ran[static_cast<size_t>(i)] == i);
+  }
+
+  // quit() from another thread wakes up a loop with nothing to do
+  void test_quit(enum io::backend::type type) {
+    io::loop lp{backend_options(type)};
+    std::thread quitter;
+    lp.setup_func([&] {
+      quitter = std::thread{[&lp] {
+        std::this_thread::sleep_for(10ms);
+        lp.quit(5);
+      }};
+    });
+    CHECK(lp.run() == 5);
+    quitter.join();
+  }
+
+  bool is_supported(enum io::backend::type type) {
+    try {
+      io::loop lp{backend_options(type)};
+      return true;
+    } catch (turbine::exception const &e) {
+      std::printf("  skipped: %s\n", e.what());
+      return false;
+    }
+  }
+
+} // namespace
+
+int main() {
+  const std::pair<enum io::backend::type, char const *> backends[] = {
+      {io::backend::type::epoll, "epoll"},
+      {io::backend::type::io_uring, "io_uring"},
+  };
+  for (auto [type, name] : backends) {
+    std::printf("%s\n", name);
+    if (!is_supported(type))
+      continue;
+    test_timers(type);
+    test_stalled_timers(type);
+    test_level_triggered(type);
+    test_edge_triggered(type);
+    test_one_shot(type);
+    test_post(type);
+    test_quit(type);
+  }
+  return 0;
+}
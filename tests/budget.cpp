@@ -0,0 +1,136 @@
+// Dispatch budgets under sustained overload: every source keeps getting
+// turns, the ready queues don't grow and fair queueing groups share the
+// dispatch time by weight
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+
+#include <unistd.h>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+using poll_events = io::poll_source::poll_events;
+
+namespace {
+
+  constexpr const size_t num_pipes = 10;
+  constexpr const uint64_t dispatches = 500000;
+
+  size_t resident_bytes() {
+    std::ifstream statm{"/proc/self/statm"};
+    size_t total = 0;
+    size_t resident = 0;
+    statm >> total >> resident;
+    return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  }
+
+  // Always readable pipes, with a budget so small that only one source
+  // is dispatched per iteration
+  io::loop::statistics run_overloaded(io::loop::options const &opts) {
+    std::array<posix::pipe::pair, num_pipes> pipes;
+    std::array<uint64_t, num_pipes> calls{};
+    uint64_t total = 0;
+    io::loop lp{opts};
+    for (size_t i = 0; i < num_pipes; i++) {
+      pipes[i] = posix::pipe::make(posix::pipe::flags::non_blocking);
+      pipes[i].write_end->write('x');
+      lp.add_poll(pipes[i].read_end, poll_events::in, [&, i](poll_events) {
+        calls[i]++;
+        if (++total == dispatches)
+          lp.quit(0);
+        return result::keep_going;
+      });
+    }
+    const auto before = resident_bytes();
+    CHECK(lp.run() == 0);
+    const auto after = resident_bytes();
+    const auto growth = after > before ? after - before : 0;
+    std::printf("  %lu dispatches, RSS +%zu KiB\n",
+                static_cast<unsigned long>(total), growth / 1024);
+    CHECK(growth < 2 * 1024 * 1024);
+    for (auto c : calls)
+      CHECK(c > dispatches / num_pipes / 2);
+    return lp.stats();
+  }
+
+  void test_dispatch_budget() {
+    io::loop::options opts;
+    opts.dispatch_budget = 1ns;
+    const auto stats = run_overloaded(opts);
+    CHECK(stats.budget_exhausted > dispatches / 2);
+  }
+
+  void test_level_budget() {
+    io::loop::options opts;
+    opts.priority_budget.fill(1ns);
+    const auto stats = run_overloaded(opts);
+    uint64_t stops = 0;
+    for (auto n : stats.priority_budget_exhausted)
+      stops += n;
+    CHECK(stops > dispatches / 2);
+  }
+
+  void test_fair_queueing() {
+    io::loop::options opts;
+    opts.dispatch_budget = 1ns;
+    opts.fair_queueing = true;
+    const auto stats = run_overloaded(opts);
+    CHECK(stats.budget_exhausted > dispatches / 2);
+  }
+
+  void spin(std::chrono::nanoseconds d) {
+    const auto end = std::chrono::steady_clock::now() + d;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+  }
+
+  // Groups at weights 1 and 3 with the same always ready sources get
+  // about a quarter and three quarters of the dispatch time. Each group
+  // alone has more work ready than fits in the budget, so they compete.
+  void test_group_weights() {
+    io::loop::options opts;
+    opts.dispatch_budget = 400us;
+    opts.fair_queueing = true;
+    io::loop lp{opts};
+    auto light = lp.add_group(1);
+    auto heavy = lp.add_group(3);
+    std::array<posix::pipe::pair, 48> pipes;
+    for (size_t i = 0; i < pipes.size(); i++) {
+      pipes[i] = posix::pipe::make(posix::pipe::flags::non_blocking);
+      pipes[i].write_end->write('x');
+      auto src = lp.add_poll(pipes[i].read_end, poll_events::in,
+                             [](poll_events) {
+                               spin(20us);
+                               return result::keep_going;
+                             });
+      src->group(i % 2 ? *heavy : *light);
+    }
+    lp.add_timeout(300ms, [&lp] {
+      lp.quit(0);
+      return result::remove;
+    });
+    CHECK(lp.run() == 0);
+    const auto ratio = static_cast<double>(heavy->dispatch_time().count()) /
+                       static_cast<double>(light->dispatch_time().count());
+    CHECK(ratio > 2 && ratio < 4);
+    CHECK(heavy->dispatches() > light->dispatches());
+  }
+
+} // namespace
+
+int main() {
+  test_dispatch_budget();
+  test_level_budget();
+  test_fair_queueing();
+  test_group_weights();
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Idle sources: they only run in iterations where no timer or other source
+// was dispatched, and back off while their callbacks find no work
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+using poll_events = io::poll_source::poll_events;
+
+namespace {
+
+  void quit_after(io::loop &lp, std::chrono::milliseconds timeout) {
+    lp.add_timeout(timeout, [&lp] {
+      lp.quit(0);
+      return result::remove;
+    });
+  }
+
+  bool disjoint(std::set<uint64_t> const &a, std::set<uint64_t> const &b) {
+    for (auto i : a) {
+      if (b.contains(i))
+        return false;
+    }
+    return true;
+  }
+
+  // The idle callback outlasts the timer's period, so the timer has
+  // expired by the next iteration and fires in step 1, before any wait
+  void test_timers() {
+    io::loop lp;
+    std::set<uint64_t> fired;
+    std::set<uint64_t> idle;
+    lp.add_timeout(1ms, [&] {
+      fired.insert(lp.iteration());
+      return result::keep_going;
+    });
+    lp.add_idle([&] {
+      idle.insert(lp.iteration());
+      std::this_thread::sleep_for(1500us);
+      return result::keep_going;
+    });
+    quit_after(lp, 50ms);
+    CHECK(lp.run() == 0);
+    CHECK(fired.size() > 10);
+    CHECK(!idle.empty());
+    CHECK(disjoint(fired, idle));
+  }
+
+  // A readable pipe keeps the idle source from running until drained
+  void test_polls() {
+    constexpr const int n_bytes = 20;
+    auto p = posix::pipe::make(posix::pipe::flags::non_blocking);
+    for (int i = 0; i < n_bytes; i++)
+      p.write_end->write('x');
+    io::loop lp;
+    std::set<uint64_t> polled;
+    std::set<uint64_t> idle;
+    lp.add_poll(p.read_end, poll_events::in, [&](poll_events) {
+      char c;
+      p.read_end->read(c);
+      polled.insert(lp.iteration());
+      return result::keep_going;
+    });
+    lp.add_idle([&] {
+      idle.insert(lp.iteration());
+      if (idle.size() == 5)
+        lp.quit(0);
+      return result::keep_going;
+    });
+    lp.add_timeout(2s, [&lp] {
+      lp.quit(-1);
+      return result::remove;
+    });
+    CHECK(lp.run() == 0);
+    CHECK(polled.size() == n_bytes);
+    CHECK(*idle.begin() > *polled.rbegin());
+  }
+
+  // The delay doubles from the minimum up to the maximum while the source
+  // finds no work and drops back to 0 once it does
+  void test_backoff() {
+    constexpr const int idle_runs = 6;
+    io::loop lp;
+    std::vector<uint64_t> delays;
+    std::vector<uint64_t> times;
+    auto src = lp.add_idle([&](io::idle_source &self) {
+      delays.push_back(static_cast<uint64_t>(self.delay().count()));
+      times.push_back(lp.now());
+      const auto runs = delays.size();
+      if (runs <= idle_runs)
+        self.mark_idle();
+      if (runs == idle_runs + 3)
+        lp.quit(0);
+      return result::keep_going;
+    });
+    src->backoff(1ms, 8ms);
+    lp.add_timeout(2s, [&lp] {
+      lp.quit(-1);
+      return result::remove;
+    });
+    CHECK(lp.run() == 0);
+    const std::vector<uint64_t> expected = {
+        0, 1000000, 2000000, 4000000, 8000000, 8000000, 8000000, 0, 0};
+    CHECK(delays == expected);
+    for (size_t i = 1; i < times.size(); i++)
+      CHECK(times[i] - times[i - 1] >= delays[i]);
+  }
+
+} // namespace
+
+int main() {
+  test_timers();
+  test_polls();
+  test_backoff();
+  return 0;
+}
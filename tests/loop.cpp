@@ -0,0 +1,217 @@
+// io::loop's dispatch machinery: interest changes applied once per
+// iteration, an event buffer sized to the number of ready sources and
+// ready sources dispatched by priority
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+using poll_events = io::poll_source::poll_events;
+
+namespace {
+
+  posix::pipe::pair make_pipe() {
+    return posix::pipe::make(posix::pipe::flags::non_blocking |
+                             posix::pipe::flags::close_on_exec);
+  }
+
+  // Fails the test instead of hanging if the loop never quits
+  void add_watchdog(io::loop &lp) {
+    lp.add_timeout(2s, [&lp] {
+      lp.quit(-1);
+      return result::remove;
+    });
+  }
+
+  // Several modify() calls within an iteration cost one epoll_ctl() for
+  // their net change, none if they cancel each other out
+  void test_coalesced_interest() {
+    const auto in = poll_events::in;
+    const auto in_out = poll_events::in | poll_events::out;
+    auto p = make_pipe();
+    io::loop lp;
+    auto src = lp.add_poll(p.read_end, in, [&lp](poll_events) {
+      lp.quit(0);
+      return result::keep_going;
+    });
+    io::loop::statistics before{};
+    int step = 0;
+    lp.add_timeout(1ms, [&] {
+      auto const &s = lp.stats();
+      switch (step++) {
+      case 0:
+        before = s;
+        lp.modify(*src, in_out);
+        lp.modify(*src, in);
+        lp.modify(*src, in_out);
+        break;
+      case 1:
+        CHECK(s.interest_updates - before.interest_updates == 3);
+        CHECK(s.epoll_ctl_calls - before.epoll_ctl_calls == 1);
+        CHECK(s.epoll_ctl_coalesced - before.epoll_ctl_coalesced == 2);
+        before = s;
+        lp.modify(*src, in);
+        lp.modify(*src, in_out);
+        break;
+      default:
+        CHECK(s.interest_updates - before.interest_updates == 2);
+        CHECK(s.epoll_ctl_calls == before.epoll_ctl_calls);
+        CHECK(s.epoll_ctl_coalesced - before.epoll_ctl_coalesced == 2);
+        // a real change still takes a call
+        lp.modify(*src, in);
+        p.write_end->write('x');
+        return result::remove;
+      }
+      return result::keep_going;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    CHECK(step == 3);
+    CHECK(lp.stats().epoll_ctl_calls == before.epoll_ctl_calls + 1);
+  }
+
+  // Always readable pipes, each of which records the iterations it was
+  // dispatched in
+  struct readable_pipes {
+    std::vector<posix::pipe::pair> pipes;
+    std::vector<io::poll_source_ptr> sources;
+    std::vector<std::vector<uint64_t>> iterations;
+
+    readable_pipes(io::loop &lp, size_t n) : iterations(n) {
+      for (size_t i = 0; i < n; i++) {
+        pipes.push_back(make_pipe());
+        pipes.back().write_end->write('x');
+        sources.push_back(lp.add_poll(
+            pipes.back().read_end, poll_events::in, [&lp, this, i](auto) {
+              iterations[i].push_back(lp.iteration());
+              return result::keep_going;
+            }));
+      }
+    }
+
+    void remove(io::loop &lp) {
+      for (auto &src : sources)
+        lp.remove(*src);
+    }
+  };
+
+  // The buffer doubles while waits fill it, up to the maximum, and halves
+  // back to the minimum once waits keep reporting few events
+  void test_event_buffer() {
+    io::loop::options opts;
+    opts.min_events = 4;
+    opts.max_events = 64;
+    io::loop lp{opts};
+    CHECK(lp.event_capacity() == 4);
+    readable_pipes ready{lp, 40};
+    size_t grown = 0;
+    uint64_t idle_runs = 0;
+    lp.add_timeout(1ms, [&] {
+      if (lp.event_capacity() < opts.max_events)
+        return result::keep_going;
+      grown = lp.event_capacity();
+      ready.remove(lp);
+      return result::remove;
+    });
+    lp.add_idle([&] {
+      idle_runs++;
+      if (lp.event_capacity() == opts.min_events)
+        lp.quit(0);
+      return result::keep_going;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    CHECK(grown == 64);
+    // 4 halvings, each after 64 small waits, one of which may be the
+    // timer's iteration
+    CHECK(idle_runs >= 4 * 64 - 1);
+    for (auto const &its : ready.iterations)
+      CHECK(!its.empty());
+  }
+
+  // Full batches are drained right away, but a source reported again in
+  // the same iteration waits for the next one
+  void test_drain_batches() {
+    io::loop::options opts;
+    opts.min_events = 4;
+    opts.max_events = 4;
+    opts.max_batches = 4;
+    io::loop lp{opts};
+    readable_pipes ready{lp, 16};
+    lp.add_timeout(20ms, [&lp] {
+      lp.quit(0);
+      return result::remove;
+    });
+    CHECK(lp.run() == 0);
+    CHECK(lp.stats().drain_batches > 0);
+    for (auto const &its : ready.iterations) {
+      CHECK(its.size() > 2);
+      for (size_t i = 1; i < its.size(); i++)
+        CHECK(its[i] > its[i - 1]);
+    }
+  }
+
+  // Sources ready in the same iteration run by priority, those of a level
+  // in the order they became ready
+  void test_dispatch_order() {
+    using priority = io::source::priority;
+    constexpr const std::array<priority, 10> priorities = {
+        priority::low,    priority::high,       priority::normal,
+        priority::high,   priority::low,        priority::medium_high,
+        priority::normal, priority::medium_low, priority::high,
+        priority::normal};
+    io::loop lp;
+    std::vector<posix::pipe::pair> pipes;
+    std::vector<size_t> order;
+    // added in reverse so adding and readiness orders differ
+    for (size_t i = 0; i < priorities.size(); i++)
+      pipes.push_back(make_pipe());
+    for (size_t i = priorities.size(); i-- > 0;) {
+      lp.add_poll(
+          pipes[i].read_end, poll_events::in,
+          [&, i](poll_events) {
+            char c;
+            pipes[i].read_end->read(c);
+            order.push_back(i);
+            if (order.size() == priorities.size())
+              lp.quit(0);
+            return result::keep_going;
+          },
+          priorities[i]);
+    }
+    lp.add_timeout(1ms, [&pipes] {
+      for (auto &p : pipes)
+        p.write_end->write('x');
+      return result::remove;
+    });
+    add_watchdog(lp);
+    CHECK(lp.run() == 0);
+    std::vector<size_t> expected(priorities.size());
+    for (size_t i = 0; i < expected.size(); i++)
+      expected[i] = i;
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&](size_t a, size_t b) {
+                       return priorities[a] < priorities[b];
+                     });
+    CHECK(order == expected);
+  }
+
+} // namespace
+
+int main() {
+  test_coalesced_interest();
+  test_event_buffer();
+  test_drain_batches();
+  test_dispatch_order();
+  return 0;
+}
@@ -0,0 +1,153 @@
+// Offloaded work which a bounded pool drops or rejects is reported once:
+// awaiting coroutines are resumed with an error, offload() callbacks turn
+// into an error for the error handler or, if rejected right away, into
+// offload() returning false
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using pool = common::thread_pool;
+
+namespace {
+
+  constexpr const int awaiters = 3;
+  constexpr const int callbacks = 3;
+
+  struct outcomes {
+    int values = 0;
+    int done = 0;
+    int dropped = 0;
+    int rejected = 0;
+
+    int total() const noexcept {
+      return values + done + dropped + rejected;
+    }
+  };
+
+  // Keeps the pool's only worker busy until released
+  class blocker {
+  public:
+    explicit blocker(pool &p) : m_started{false}, m_go{false} {
+      p.push([this] {
+        m_started = true;
+        m_started.notify_all();
+        m_go.wait(false);
+      });
+      m_started.wait(false);
+    }
+
+    ~blocker() {
+      release();
+    }
+
+    void release() {
+      m_go = true;
+      m_go.notify_all();
+    }
+
+  private:
+    std::atomic<bool> m_started;
+    std::atomic<bool> m_go;
+  };
+
+  void count(outcomes &out, std::string const &what) {
+    if (what == "offloaded work was dropped by the thread pool")
+      out.dropped++;
+    else if (what == "offloaded work was rejected by the thread pool")
+      out.rejected++;
+  }
+
+  io::task<void> await_offload(io::loop &lp, outcomes &out) {
+    try {
+      out.values += co_await lp.offload([] { return 1; });
+    } catch (turbine::exception const &e) {
+      count(out, e.what());
+    }
+  }
+
+  // Counts errors and quits once every piece of work is accounted for
+  void watch(io::loop &lp, outcomes &out, int expected) {
+    lp.error_func([&lp, &out, expected](turbine::exception const &e) {
+      count(out, e.what());
+      if (out.total() == expected)
+        lp.quit(0);
+      return true;
+    });
+    lp.add_timeout(2s, [&lp] {
+      lp.quit(-1);
+      return io::source::result::remove;
+    });
+    lp.add_timeout(1ms, [&lp, &out, expected] {
+      if (out.total() == expected)
+        lp.quit(0);
+      return io::source::result::keep_going;
+    });
+  }
+
+  // Only the last of the queued pieces of work survives
+  void test_drop_oldest() {
+    pool::options opts;
+    opts.threads = 1;
+    opts.max_queued = 1;
+    opts.on_overflow = pool::overflow::drop_oldest;
+    pool p{opts};
+    io::loop lp;
+    lp.pool(p);
+    outcomes out;
+    watch(lp, out, awaiters + callbacks);
+    blocker b{p};
+    lp.setup_func([&] {
+      for (int i = 0; i < callbacks; i++)
+        lp.offload([] { return 1; }, [&out](int) { out.done++; });
+      for (int i = 0; i < awaiters; i++)
+        lp.spawn(await_offload(lp, out));
+      b.release();
+    });
+    CHECK(lp.run() == 0);
+    CHECK(out.values == 1);
+    CHECK(out.done == 0);
+    CHECK(out.dropped == awaiters + callbacks - 1);
+  }
+
+  // Work rejected right away resumes its awaiter with an error, a rejected
+  // offload() only returns false
+  void test_reject() {
+    pool::options opts;
+    opts.threads = 1;
+    opts.max_queued = 1;
+    opts.on_overflow = pool::overflow::reject;
+    pool p{opts};
+    io::loop lp;
+    lp.pool(p);
+    outcomes out;
+    bool accepted = true;
+    watch(lp, out, 2);
+    blocker b{p};
+    lp.setup_func([&] {
+      lp.offload([] { return 1; }, [&out](int) { out.done++; });
+      accepted = lp.offload([] { return 1; }, [&out](int) { out.done++; });
+      lp.spawn(await_offload(lp, out));
+      b.release();
+    });
+    CHECK(lp.run() == 0);
+    CHECK(!accepted);
+    CHECK(out.done == 1);
+    CHECK(out.dropped == 0);
+    CHECK(out.rejected == 1);
+  }
+
+} // namespace
+
+int main() {
+  test_drop_oldest();
+  test_reject();
+  return 0;
+}
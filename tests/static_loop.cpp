@@ -0,0 +1,114 @@
+// io::static_loop dispatch of poll, timeout and idle sources
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <chrono>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+using poll_events = io::poll_source::poll_events;
+using input_flags = io::poll_source::input_flags;
+
+namespace {
+
+  posix::pipe::pair make_pipe() {
+    return posix::pipe::make(posix::pipe::flags::non_blocking |
+                             posix::pipe::flags::close_on_exec);
+  }
+
+  void drain(posix::fd &f) {
+    char buf[64];
+    while (::read(f.fileno(), buf, sizeof buf) > 0) {
+    }
+  }
+
+  // Each event reaches the source it belongs to, whatever its position
+  void test_dispatch() {
+    auto a = make_pipe();
+    auto b = make_pipe();
+    int a_calls = 0;
+    int b_calls = 0;
+    int ticks = 0;
+    b.write_end->write('b');
+    io::static_loop lp{
+        io::static_timeout{1ms,
+                           [&](auto &lp) {
+                             if (++ticks == 3)
+                               a.write_end->write('a');
+                             if (ticks == 20)
+                               lp.quit(a_calls == 1 && b_calls == 1 ? 0 : 1);
+                             return result::keep_going;
+                           }},
+        io::static_poll{a.read_end, poll_events::in,
+                        [&](poll_events) {
+                          a_calls++;
+                          drain(*a.read_end);
+                          return result::keep_going;
+                        }},
+        io::static_poll{b.read_end, poll_events::in, [&](poll_events) {
+                          b_calls++;
+                          drain(*b.read_end);
+                          return result::keep_going;
+                        }}};
+    CHECK(lp.run() == 0);
+    CHECK(a_calls == 1);
+    CHECK(b_calls == 1);
+  }
+
+  // One-shot sources are re-armed after each dispatch, removed ones
+  // aren't reported again
+  void test_one_shot_and_remove() {
+    auto p = make_pipe();
+    auto q = make_pipe();
+    int one_shot_calls = 0;
+    int removed_calls = 0;
+    int ticks = 0;
+    q.write_end->write('q');
+    io::static_loop lp{
+        io::static_poll{p.read_end, poll_events::in, input_flags::one_shot,
+                        [&](poll_events) {
+                          drain(*p.read_end);
+                          one_shot_calls++;
+                          return result::keep_going;
+                        }},
+        io::static_poll{q.read_end, poll_events::in,
+                        [&](poll_events) {
+                          removed_calls++;
+                          return result::remove; // never read
+                        }},
+        io::static_timeout{2ms, [&](auto &lp) {
+                             if (one_shot_calls == 3 || ++ticks == 500)
+                               lp.quit(0);
+                             else
+                               p.write_end->write('p');
+                             return result::keep_going;
+                           }}};
+    CHECK(lp.run() == 0);
+    CHECK(one_shot_calls == 3);
+    CHECK(removed_calls == 1);
+    CHECK(!lp.get<1>().is_active());
+  }
+
+  void test_idle() {
+    int runs = 0;
+    io::static_loop lp{io::static_idle{[&](auto &lp) {
+      if (++runs == 5)
+        lp.quit(0);
+      return result::keep_going;
+    }}};
+    CHECK(lp.run() == 0);
+    CHECK(runs == 5);
+  }
+
+} // namespace
+
+int main() {
+  test_dispatch();
+  test_one_shot_and_remove();
+  test_idle();
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Spawned coroutines and how the loop handles their exceptions
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using result = io::source::result;
+
+namespace {
+
+  // Sets a flag when destroyed, to tell whether a coroutine frame was
+  struct destroyed_flag {
+    bool &flag;
+
+    ~destroyed_flag() {
+      flag = true;
+    }
+  };
+
+  io::task<int> answer(io::loop &lp) {
+    co_await lp.sleep(1ms);
+    co_return 42;
+  }
+
+  io::task<void> quit_with_answer(io::loop &lp) {
+    lp.quit(co_await answer(lp));
+  }
+
+  io::task<void> throw_runtime_error(io::loop &lp) {
+    co_await lp.sleep(1ms);
+    throw std::runtime_error{"from a task"};
+  }
+
+  io::task<void> sleep_forever(io::loop &lp, bool &destroyed) {
+    destroyed_flag guard{destroyed};
+    co_await lp.sleep(1h);
+  }
+
+  void test_result() {
+    io::loop lp;
+    lp.setup_func([&lp] { lp.spawn(quit_with_answer(lp)); });
+    CHECK(lp.run() == 42);
+  }
+
+  // Exceptions of any type reach the error handler
+  void test_error_handler() {
+    io::loop lp;
+    std::string what;
+    lp.error_func([&](turbine::exception const &e) {
+      what = e.what();
+      lp.quit(1);
+      return true;
+    });
+    lp.setup_func([&lp] { lp.spawn(throw_runtime_error(lp)); });
+    CHECK(lp.run() == 1);
+    CHECK(what == "from a task");
+
+    lp.setup_func([&lp] {
+      lp.post([] { throw std::logic_error{"from a post"}; });
+    });
+    CHECK(lp.run() == 1);
+    CHECK(what == "from a post");
+  }
+
+  // Without a handler the exception leaves run(), after the teardown,
+  // and the loop can run again
+  void test_rethrow() {
+    io::loop lp;
+    int teardowns = 0;
+    lp.teardown_func([&teardowns] { teardowns++; });
+    lp.setup_func([&lp] { lp.spawn(throw_runtime_error(lp)); });
+    bool thrown = false;
+    try {
+      lp.run();
+    } catch (std::runtime_error const &e) {
+      thrown = std::string{e.what()} == "from a task";
+    }
+    CHECK(thrown);
+    CHECK(teardowns == 1);
+
+    lp.setup_func([&lp] { lp.quit(7); });
+    CHECK(lp.run() == 7);
+    CHECK(teardowns == 2);
+  }
+
+  // A loop destroys the spawned tasks which are still suspended
+  void test_destroy_suspended() {
+    bool destroyed = false;
+    {
+      io::loop lp;
+      lp.setup_func([&] {
+        lp.spawn(sleep_forever(lp, destroyed));
+        lp.spawn(sleep_forever(lp, destroyed));
+        lp.add_timeout(5ms, [&lp] {
+          lp.quit(0);
+          return result::remove;
+        });
+      });
+      CHECK(lp.run() == 0);
+      CHECK(!destroyed);
+    }
+    CHECK(destroyed);
+  }
+
+} // namespace
+
+int main() {
+  test_result();
+  test_error_handler();
+  test_rethrow();
+  test_destroy_suspended();
+  return 0;
+}
@@ -0,0 +1,726 @@
+// common::thread_pool: work stealing, NUMA placement, sizing, bounded
+// queues and their overflow policies, priorities and deadlines, bulk
+// pushes, wait groups and parallel_for
+
+#include "check.hpp"
+
+#include <turbine.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+using namespace turbine;
+using namespace std::chrono_literals;
+
+using pool = common::thread_pool;
+
+namespace {
+
+  // Keeps a worker busy until released. The worker may still be waking
+  // up when the blocker is gone, so the flags are shared with its task.
+  class blocker {
+    struct flags {
+      std::atomic<bool> started{false};
+      std::atomic<bool> go{false};
+    };
+
+  public:
+    explicit blocker(pool &p) : m_flags{std::make_shared<flags>()} {
+      p.push([f = m_flags] {
+        f->started = true;
+        f->started.notify_all();
+        f->go.wait(false);
+      });
+      m_flags->started.wait(false);
+    }
+
+    ~blocker() {
+      release();
+    }
+
+    void release() {
+      m_flags->go = true;
+      m_flags->go.notify_all();
+    }
+
+  private:
+    std::shared_ptr<flags> m_flags;
+  };
+
+  class counter {
+  public:
+    counter() noexcept : m_count{0} {
+    }
+
+    void add() {
+      m_count.fetch_add(1);
+      m_count.notify_all();
+    }
+
+    uint32_t count() const noexcept {
+      return m_count.load();
+    }
+
+    void wait_for(uint32_t n) {
+      for (auto c = m_count.load(); c < n; c = m_count.load())
+        m_count.wait(c);
+    }
+
+  private:
+    std::atomic<uint32_t> m_count;
+  };
+
+  // Sets a flag when destroyed, to tell a dropped task from one which ran
+  struct destroyed_flag {
+    std::atomic<bool> *flag;
+
+    explicit destroyed_flag(std::atomic<bool> &f) noexcept : flag{&f} {
+    }
+
+    destroyed_flag(destroyed_flag &&other) noexcept
+        : flag{std::exchange(other.flag, nullptr)} {
+    }
+
+    ~destroyed_flag() {
+      if (flag)
+        *flag = true;
+    }
+  };
+
+  // Every pushed item is taken exactly once, by its owner or a thief,
+  // while the deque grows from a tiny capacity
+  void test_work_deque() {
+    constexpr const int n_items = 200000;
+    constexpr const int n_thieves = 3;
+    std::vector<int> items(n_items);
+    std::vector<std::atomic<uint8_t>> taken(n_items);
+    common::work_deque<int> dq{2};
+    std::atomic<bool> done{false};
+    auto take = [&](int *item) {
+      taken[static_cast<size_t>(item - items.data())].fetch_add(1);
+    };
+    std::vector<std::jthread> thieves;
+    for (int i = 0; i < n_thieves; i++) {
+      thieves.emplace_back([&] {
+        while (!done) {
+          if (auto *item = dq.steal())
+            take(item);
+        }
+        while (auto *item = dq.steal())
+          take(item);
+      });
+    }
+    for (int i = 0; i < n_items; i++) {
+      dq.push(&items[static_cast<size_t>(i)]);
+      if (i % 3 == 0) {
+        if (auto *item = dq.pop())
+          take(item);
+      }
+    }
+    while (auto *item = dq.pop())
+      take(item);
+    done = true;
+    thieves.clear();
+    for (auto &t : taken)
+      CHECK(t == 1);
+  }
+
+  void fork(pool &p, std::vector<std::atomic<uint8_t>> &ran, counter &c,
+            size_t id, size_t depth) {
+    ran[id].fetch_add(1);
+    if (depth > 0) {
+      p.push([&p, &ran, &c, id, depth] {
+        fork(p, ran, c, 2 * id + 1, depth - 1);
+      });
+      p.push([&p, &ran, &c, id, depth] {
+        fork(p, ran, c, 2 * id + 2, depth - 1);
+      });
+    }
+    c.add();
+  }
+
+  // Tasks pushed from workers onto their own deques and stolen by the
+  // others, mixed with tasks pushed from outside, each run exactly once
+  void test_push_and_steal() {
+    constexpr const size_t depth = 12;
+    constexpr const size_t forked = (size_t{1} << (depth + 1)) - 1;
+    constexpr const size_t external = 5000;
+    constexpr const size_t n_pushers = 2;
+    std::vector<std::atomic<uint8_t>> ran(forked + n_pushers * external);
+    counter c;
+    pool p{4};
+    p.push([&] { fork(p, ran, c, 0, depth); });
+    std::vector<std::jthread> pushers;
+    for (size_t t = 0; t < n_pushers; t++) {
+      pushers.emplace_back([&, t] {
+        for (size_t i = 0; i < external; i++) {
+          const auto id = forked + t * external + i;
+          p.push([&ran, &c, id] {
+            ran[id].fetch_add(1);
+            c.add();
+          });
+        }
+      });
+    }
+    pushers.clear();
+    c.wait_for(static_cast<uint32_t>(ran.size()));
+    for (auto &r : ran)
+      CHECK(r == 1);
+  }
+
+  void test_parse_cpu_list() {
+    CHECK((linux::numa::parse_cpu_list("0-3,8,10-11\n") ==
+           std::vector<uint32_t>{0, 1, 2, 3, 8, 10, 11}));
+    CHECK(linux::numa::parse_cpu_list("").empty());
+  }
+
+  size_t affinity_cpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CHECK(::sched_getaffinity(0, sizeof set, &set) == 0);
+    return static_cast<size_t>(CPU_COUNT(&set));
+  }
+
+  // Tasks with node and core hints, known or not, pushed from outside and
+  // from workers, run exactly once, on workers pinned before their first
+  // task
+  void test_affinity() {
+    pool::options opts;
+    opts.pin = pool::pinning::core;
+    opts.threads = 2 * static_cast<uint32_t>(
+                           linux::numa::allowed_cpus().size());
+    pool p{opts};
+    std::vector<pool::affinity> hints{pool::affinity::node(1000000),
+                                      pool::affinity::core(1000000)};
+    for (auto id : p.nodes())
+      hints.push_back(pool::affinity::node(id));
+    for (auto cpu : linux::numa::allowed_cpus())
+      hints.push_back(pool::affinity::core(cpu));
+
+    constexpr const size_t per_hint = 100;
+    std::vector<std::atomic<uint8_t>> ran(2 * hints.size() * per_hint);
+    std::atomic<bool> pinned{true};
+    counter c;
+    auto task = [&](size_t id) {
+      return [&, id] {
+        if (affinity_cpus() != 1)
+          pinned = false;
+        ran[id].fetch_add(1);
+        c.add();
+      };
+    };
+    size_t id = 0;
+    for (auto const &h : hints) {
+      for (size_t i = 0; i < per_hint; i++)
+        p.push(task(id++), h);
+    }
+    p.push([&] {
+      size_t id = hints.size() * per_hint;
+      for (auto const &h : hints) {
+        for (size_t i = 0; i < per_hint; i++)
+          p.push(task(id++), h);
+      }
+    });
+    c.wait_for(static_cast<uint32_t>(ran.size()));
+    CHECK(pinned);
+    for (auto &r : ran)
+      CHECK(r == 1);
+  }
+
+  // Workers retired while their deques and mailboxes hold tasks hand
+  // them over, none is lost or run twice
+  void test_resize() {
+    constexpr const size_t n_tasks = 20000;
+    pool::options opts;
+    opts.threads = 1;
+    opts.max_threads = 4;
+    pool p{opts};
+    std::vector<std::atomic<uint8_t>> ran(2 * n_tasks);
+    counter c;
+    auto task = [&](size_t id) {
+      return [&, id] {
+        ran[id].fetch_add(1);
+        c.add();
+      };
+    };
+    std::atomic<bool> pushing{true};
+    std::jthread resizer{[&] {
+      const uint32_t sizes[] = {4, 2, 1, 3, 1, 4};
+      for (size_t i = 0; pushing; i++) {
+        p.resize(sizes[i % std::size(sizes)]);
+        std::this_thread::sleep_for(100us);
+      }
+    }};
+    for (size_t i = 0; i < n_tasks; i++) {
+      if (i % 100 == 0) {
+        // these land on the deque of whichever worker runs this
+        p.push([&, i] {
+          for (size_t j = 0; j < 100; j++)
+            p.push(task(n_tasks + i + j));
+        });
+      }
+      p.push(task(i), pool::affinity::core(static_cast<uint32_t>(i % 4)));
+    }
+    c.wait_for(static_cast<uint32_t>(ran.size()));
+    pushing = false;
+    resizer.join();
+    for (auto &r : ran)
+      CHECK(r == 1);
+    p.resize(0);
+    CHECK(p.size() == 1);
+    p.resize(100);
+    CHECK(p.size() == p.max_size());
+  }
+
+  // Writes `text` to a file named `name` in `dir`
+  void write_file(std::filesystem::path const &dir, char const *name,
+                  char const *text) {
+    std::ofstream{dir / name} << text;
+  }
+
+  void test_cgroup() {
+    namespace detail = linux::cgroup::detail;
+    const auto dir = std::filesystem::temp_directory_path() /
+                     ("turbine-cgroup-" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+
+    write_file(dir, "cpu.max", "150000 100000\n");
+    const auto limit = detail::read_cpu_max(dir / "cpu.max");
+    CHECK(limit && *limit == 1.5);
+    write_file(dir, "cpu.max", "max 100000\n");
+    CHECK(!detail::read_cpu_max(dir / "cpu.max"));
+    CHECK(!detail::read_cpu_max(dir / "missing"));
+
+    write_file(dir, "cpu.cfs_quota_us", "50000\n");
+    write_file(dir, "cpu.cfs_period_us", "100000\n");
+    const auto cfs = detail::read_cfs(dir);
+    CHECK(cfs && *cfs == 0.5);
+    write_file(dir, "cpu.cfs_quota_us", "-1\n");
+    CHECK(!detail::read_cfs(dir));
+    std::filesystem::remove_all(dir);
+
+    pool p{1};
+    const auto n = p.default_size();
+    CHECK(n >= 1 && n <= linux::numa::allowed_cpus().size());
+  }
+
+  pool::options bounded(pool::overflow policy, size_t max_queued) {
+    pool::options opts;
+    opts.threads = 1;
+    opts.max_queued = max_queued;
+    opts.on_overflow = policy;
+    return opts;
+  }
+
+  // A full queue makes push() wait until a task is taken
+  void test_block() {
+    pool p{bounded(pool::overflow::block, 2)};
+    counter ran;
+    blocker b{p};
+    CHECK(p.push([&ran] { ran.add(); }));
+    CHECK(p.push([&ran] { ran.add(); }));
+    CHECK(p.queued() == 2);
+    std::atomic<bool> pushed{false};
+    std::jthread pusher{[&] {
+      CHECK(p.push([&ran] { ran.add(); }));
+      pushed = true;
+    }};
+    std::this_thread::sleep_for(20ms);
+    CHECK(!pushed);
+    b.release();
+    ran.wait_for(3);
+    pusher.join();
+    CHECK(pushed);
+    CHECK(p.rejected() == 0);
+  }
+
+  void test_reject() {
+    pool p{bounded(pool::overflow::reject, 2)};
+    counter ran;
+    blocker b{p};
+    CHECK(p.push([&ran] { ran.add(); }));
+    CHECK(p.push([&ran] { ran.add(); }));
+    CHECK(!p.push([&ran] { ran.add(); }));
+    CHECK(p.rejected() == 1);
+    b.release();
+    ran.wait_for(2);
+    std::this_thread::sleep_for(5ms);
+    CHECK(ran.count() == 2);
+  }
+
+  void test_caller_runs() {
+    pool p{bounded(pool::overflow::caller_runs, 2)};
+    counter ran;
+    blocker b{p};
+    CHECK(p.push([&ran] { ran.add(); }));
+    CHECK(p.push([&ran] { ran.add(); }));
+    std::thread::id runner;
+    CHECK(p.push([&] {
+      runner = std::this_thread::get_id();
+      ran.add();
+    }));
+    CHECK(runner == std::this_thread::get_id());
+    CHECK(ran.count() == 1);
+    b.release();
+    ran.wait_for(3);
+  }
+
+  // The oldest queued task is destroyed without running, the new one
+  // takes its place
+  void test_drop_oldest() {
+    pool p{bounded(pool::overflow::drop_oldest, 2)};
+    std::atomic<bool> ran[3] = {false, false, false};
+    std::atomic<bool> destroyed[3] = {false, false, false};
+    counter done;
+    blocker b{p};
+    for (int i = 0; i < 3; i++) {
+      CHECK(p.push([&, i, d = destroyed_flag{destroyed[i]}] {
+        ran[i] = true;
+        done.add();
+      }));
+    }
+    CHECK(destroyed[0]);
+    CHECK(!ran[0]);
+    CHECK(p.dropped() == 1);
+    CHECK(p.queued() == 2);
+    b.release();
+    done.wait_for(2);
+    CHECK(ran[1] && ran[2]);
+    CHECK(!ran[0]);
+  }
+
+  // try_push() never waits and leaves a task it couldn't queue as it was
+  void test_try_push() {
+    pool p{bounded(pool::overflow::block, 1)};
+    counter ran;
+    blocker b{p};
+    pool::task_func first{[&ran] { ran.add(); }};
+    CHECK(p.try_push(std::move(first)));
+    pool::task_func second{[&ran] { ran.add(); }};
+    CHECK(!p.try_push(std::move(second)));
+    CHECK(second);
+    b.release();
+    ran.wait_for(1);
+    CHECK(p.try_push(std::move(second)));
+    ran.wait_for(2);
+  }
+
+  // Each crossing of a watermark is reported once, going up at the high
+  // one and down at the low one
+  void test_watermarks() {
+    pool::options opts;
+    opts.threads = 1;
+    opts.high_watermark = 3;
+    opts.low_watermark = 1;
+    std::vector<bool> calls;
+    {
+      pool p{opts};
+      p.watermark_func([&calls](bool above) { calls.push_back(above); });
+      counter ran;
+      for (int round = 1; round <= 2; round++) {
+        blocker b{p};
+        for (int i = 0; i < 5; i++)
+          p.push([&ran] { ran.add(); });
+        CHECK(p.queued() == 5);
+        b.release();
+        ran.wait_for(5 * round);
+      }
+    } // the callbacks are done once the workers are
+    CHECK((calls == std::vector<bool>{true, false, true, false}));
+  }
+
+  // Order in which tasks ran
+  class recorder {
+  public:
+    pool::task_func task(int id) {
+      return [this, id] {
+        {
+          std::lock_guard lk{m_lock};
+          m_order.push_back(id);
+        }
+        m_ran.add();
+      };
+    }
+
+    std::vector<int> wait_for(uint32_t n) {
+      m_ran.wait_for(n);
+      std::lock_guard lk{m_lock};
+      return m_order;
+    }
+
+  private:
+    std::mutex m_lock;
+    std::vector<int> m_order;
+    counter m_ran;
+  };
+
+  pool::options unaged() {
+    pool::options opts;
+    opts.threads = 1;
+    opts.aging = 1h;
+    return opts;
+  }
+
+  // High priority first, plain and normal ones together in push order,
+  // low priority last
+  void test_priorities() {
+    pool p{unaged()};
+    recorder r;
+    {
+      blocker b{p};
+      p.push(r.task(5), pool::priority::low);
+      p.push(r.task(3));
+      p.push(r.task(1), pool::priority::high);
+      p.push(r.task(4), pool::priority::normal);
+      p.push(r.task(2), pool::priority::high);
+    }
+    CHECK((r.wait_for(5) == std::vector<int>{1, 2, 3, 4, 5}));
+  }
+
+  // Earliest deadline first within a class, ahead of the tasks of the
+  // class without one
+  void test_deadlines() {
+    pool p{unaged()};
+    recorder r;
+    const auto now = std::chrono::steady_clock::now();
+    {
+      blocker b{p};
+      p.push(r.task(7));
+      p.push(r.task(4), pool::priority::high);
+      p.push(r.task(3), pool::priority::high, now + 3s);
+      p.push(r.task(1), pool::priority::high, now + 1s);
+      p.push(r.task(6), pool::priority::normal, now + 2s);
+      p.push(r.task(2), pool::priority::high, now + 2s);
+      p.push(r.task(5), pool::priority::normal, now + 1s);
+    }
+    CHECK((r.wait_for(7) == std::vector<int>{1, 2, 3, 4, 5, 6, 7}));
+    CHECK(p.queue_delays()[0].items == 4);
+    CHECK(p.queue_delays()[1].items == 2);
+  }
+
+  // A low priority task gets to run even though high priority ones keep
+  // coming, once it has aged into their class
+  void test_aging() {
+    pool::options opts;
+    opts.threads = 1;
+    opts.aging = 5ms;
+    pool p{opts};
+    std::atomic<bool> low_ran{false};
+    std::atomic<int> rounds{0};
+    counter done;
+    std::function<void()> busy = [&] {
+      std::this_thread::sleep_for(200us);
+      if (!low_ran && ++rounds < 2000)
+        p.push(busy, pool::priority::high);
+      else
+        done.add();
+    };
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration waited{};
+    {
+      blocker b{p};
+      p.push(busy, pool::priority::high);
+      p.push(
+          [&] {
+            waited = std::chrono::steady_clock::now() - start;
+            low_ran = true;
+          },
+          pool::priority::low);
+    }
+    done.wait_for(1);
+    CHECK(low_ran);
+    CHECK(rounds < 2000);
+    CHECK(waited >= 10ms); // two classes up
+    CHECK(p.queue_delays()[2].items == 1);
+  }
+
+  // Every task of a bulk push runs once, a bounded pool takes as many as
+  // it has room for
+  void test_push_bulk() {
+    {
+      pool p{3};
+      counter ran;
+      std::vector<std::function<void()>> fncs;
+      for (int i = 0; i < 1000; i++)
+        fncs.emplace_back([&ran] { ran.add(); });
+      CHECK(p.push_bulk(fncs) == 1000);
+      ran.wait_for(1000);
+      std::this_thread::sleep_for(5ms);
+      CHECK(ran.count() == 1000);
+    }
+    pool p{bounded(pool::overflow::reject, 2)};
+    counter ran;
+    blocker b{p};
+    std::vector<std::function<void()>> fncs;
+    for (int i = 0; i < 5; i++)
+      fncs.emplace_back([&ran] { ran.add(); });
+    CHECK(p.push_bulk(fncs) == 2);
+    CHECK(p.rejected() == 3);
+    b.release();
+    ran.wait_for(2);
+  }
+
+  // wait() returns once every task finished, rethrowing the first error
+  void test_wait_group() {
+    pool p{3};
+    pool::wait_group wg{p};
+    std::atomic<int> finished{0};
+    for (int i = 0; i < 64; i++) {
+      wg.push([&finished] {
+        std::this_thread::sleep_for(100us);
+        finished++;
+      });
+    }
+    wg.wait();
+    CHECK(finished == 64);
+    CHECK(wg.pending() == 0);
+
+    finished = 0;
+    for (int i = 0; i < 16; i++) {
+      wg.push([&finished, i] {
+        std::this_thread::sleep_for(100us);
+        finished++;
+        if (i == 3)
+          throw std::runtime_error{"task 3"};
+      });
+    }
+    bool thrown = false;
+    try {
+      wg.wait();
+    } catch (std::runtime_error const &e) {
+      thrown = std::string{e.what()} == "task 3";
+    }
+    CHECK(thrown);
+    CHECK(finished == 16);
+    wg.wait(); // the error was reported
+  }
+
+  // A task the pool drops still counts as finished, as an error
+  void test_wait_group_dropped() {
+    pool p{bounded(pool::overflow::drop_oldest, 1)};
+    pool::wait_group wg{p};
+    counter ran;
+    blocker b{p};
+    CHECK(wg.push([&ran] { ran.add(); }));
+    CHECK(wg.push([&ran] { ran.add(); }));
+    CHECK(p.dropped() == 1);
+    b.release();
+    bool thrown = false;
+    try {
+      wg.wait();
+    } catch (turbine::exception const &e) {
+      thrown = std::string{e.what()} == "task was dropped by the thread pool";
+    }
+    CHECK(thrown);
+    CHECK(ran.count() == 1);
+  }
+
+  // Tasks waiting for the tasks they forked don't tie up the only worker
+  void test_wait_group_nested() {
+    pool p{1};
+    pool::wait_group outer{p};
+    std::atomic<int> finished{0};
+    for (int i = 0; i < 4; i++) {
+      outer.push([&p, &finished] {
+        pool::wait_group inner{p};
+        for (int j = 0; j < 8; j++)
+          inner.push([&finished] { finished++; });
+        inner.wait();
+      });
+    }
+    outer.wait();
+    CHECK(finished == 32);
+  }
+
+  void check_parallel_for(pool &p, int first, int last, int grain) {
+    std::vector<std::atomic<uint8_t>> seen(1100);
+    p.parallel_for(first, last, grain,
+                   [&seen](int i) { seen[static_cast<size_t>(i)]++; });
+    for (int i = 0; i < static_cast<int>(seen.size()); i++)
+      CHECK(seen[static_cast<size_t>(i)] == (i >= first && i < last));
+
+    // sub-ranges are at most grain long, grains below 1 mean 1
+    std::vector<std::atomic<uint8_t>> covered(1100);
+    std::atomic<bool> too_long{false};
+    p.parallel_for(first, last, grain, [&](int lo, int hi) {
+      if (hi - lo > std::max(grain, 1) || lo >= hi)
+        too_long = true;
+      for (auto i = lo; i < hi; i++)
+        covered[static_cast<size_t>(i)]++;
+    });
+    CHECK(!too_long);
+    for (size_t i = 0; i < covered.size(); i++)
+      CHECK(covered[i] == seen[i]);
+  }
+
+  // [first, last) is covered exactly once whatever the range and grain,
+  // from outside the pool or from one of its workers
+  void test_parallel_for() {
+    pool p{4};
+    const int ranges[][3] = {
+        {0, 1000, 7},  {3, 1000, 64}, {5, 6, 1},       {0, 1001, 1000},
+        {0, 1024, 1},  {17, 983, 0},  {10, 10, 3},     {20, 10, 3},
+        {0, 1000, -5}, {1, 2, 100},   {0, 1099, 1098},
+    };
+    for (auto const &r : ranges)
+      check_parallel_for(p, r[0], r[1], r[2]);
+
+    counter done;
+    for (auto const &r : ranges) {
+      p.push([&p, &done, r] {
+        check_parallel_for(p, r[0], r[1], r[2]);
+        done.add();
+      });
+    }
+    done.wait_for(std::size(ranges));
+
+    // nested on a single worker
+    pool one{1};
+    std::atomic<int> sum{0};
+    one.parallel_for(0, 10, 1, [&](int) {
+      one.parallel_for(0, 100, 3, [&](int i) { sum += i; });
+    });
+    CHECK(sum == 10 * 4950);
+  }
+
+} // namespace
+
+int main() {
+  test_work_deque();
+  test_push_and_steal();
+  test_parse_cpu_list();
+  test_affinity();
+  test_resize();
+  test_cgroup();
+  test_block();
+  test_reject();
+  test_caller_runs();
+  test_drop_oldest();
+  test_try_push();
+  test_watermarks();
+  test_priorities();
+  test_deadlines();
+  test_aging();
+  test_push_bulk();
+  test_wait_group();
+  test_wait_group_dropped();
+  test_wait_group_nested();
+  test_parallel_for();
+  return 0;
+}